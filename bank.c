@@ -1,23 +1,209 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <ctype.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <limits.h>
 #include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #define MAX_NAME_LENGTH 100
 #define MAX_PASSWORD_LENGTH 50
 #define FILENAME "mishterious_bank_data.dat"
+#define SNAPSHOT_SHARD_FILE "mishterious_bank_data.%d.dat"
+#define ACCOUNT_SHARDS 8
 #define TRANSACTION_HISTORY_FILE "transaction_history.dat"
+#define TRANSACTION_SEGMENT_FILE "transaction_history.%04d.dat"
+#define TRANSACTION_INDEX_FILE "transaction_index.dat"
+#define RECENT_TRANSACTION_COUNT 5
+#define APPENDER_BUFFER_SIZE 65536
+#define GROUP_COMMIT_RECORDS 32
+#define GROUP_COMMIT_INTERVAL_MS 50
+#define WAL_FILE "mishterious_bank_wal.dat"
+#define WAL_CHECKPOINT_THRESHOLD 1000
+#define WAL_MAX_BATCH 8
+#define COMMIT_FAILED -1
+#define ACCOUNT_LOCK_STRIPES 256
+#define ACCOUNT_STORAGE_LIMIT (1 << 24)
+#define ACCOUNT_STORAGE_CHUNK 65536
+#define STRESS_ACCOUNTS 1000
+#define STRESS_OPENING_BALANCE 100000
+#define ACCOUNT_NUMBER_BASE 33000000LL
+#define ACCOUNT_NUMBER_RANGE 1000000
+#define ACCOUNT_NUMBER_MULTIPLIER 738197
+#define ACCOUNT_NUMBER_OFFSET 271829
+#define SYNTHETIC_ACCOUNT_BASE ACCOUNT_NUMBER_BASE
+#define BENCH_DEFAULT_ACCOUNTS 10000
+#define BENCH_DEFAULT_OPERATIONS 20000
+#define BENCH_PASSWORD "Bench123"
+#define PASSWORD_HASH_DEFAULT_COST 14
+#define PASSWORD_HASH_MAX_COST 20
+#define STRESS_PASSWORD_HASH_COST 4
+#define LOGIN_BURST_MAX 64
+#define LOGIN_BENCH_ACCOUNTS 100
+#define LOGIN_BENCH_DEFAULT_LOGINS 100
+#define BALANCE_BUCKETS 6
+#define TOP_ACCOUNTS 10
+#define BULK_WRITER_BUFFER_SIZE (1 << 20)
+#define BULK_WRITER_LINE_MAX 512
+#define LISTING_PAGE_SIZE 20
+#define LISTING_PARALLEL_THRESHOLD 65536
+#define LISTING_MAX_SORT_THREADS 8
+#define NAME_SEARCH_SEEK_LIMIT 1024
+#define BOOK_SNAPSHOT_PAGE 4096
+#define HISTORY_SEGMENT_MAX_BYTES (4L << 20)
+#define STATEMENT_MAX_WORKERS 8
+#define STATEMENT_DEFAULT_DIRECTORY "statements"
+#define NO_PRIOR_BALANCE LLONG_MIN
+#define METRICS_FILE "mishterious_bank_metrics.prom"
+#define METRICS_DEFAULT_INTERVAL 0
+#define METRIC_BUCKETS 40
+#define METRIC_LOOKUP_SAMPLE_MASK 63
+#define MINIMUM_OPENING_DEPOSIT 10000
+#define FILE_FORMAT_VERSION 2
+#define SNAPSHOT_FORMAT_VERSION 3
+#define SNAPSHOT_BLOCK_SIZE 65536
+#define SNAPSHOT_MAGIC 0x4B4E424DU
+#define WAL_MAGIC 0x4C414D4DU
+#define HISTORY_MAGIC 0x5854424DU
+#define HISTORY_SEGMENT_MAGIC 0x4753424DU
+#define HISTORY_FORMAT_VERSION 3
+#define HISTORY_READ_BUFFER 65536
+#define HISTORY_DATA_START ((long)sizeof(SegmentHeader))
+
+// A history location packs a segment number and a byte offset within that
+// segment into one long, so locations still order by position in the log.
+#define HISTORY_SEGMENT_SHIFT 40
+#define HISTORY_LOCATION(segment, offset) (((long)(segment) << HISTORY_SEGMENT_SHIFT) | (offset))
+#define LOCATION_SEGMENT(location) ((int)((location) >> HISTORY_SEGMENT_SHIFT))
+#define LOCATION_OFFSET(location) ((location) & ((1L << HISTORY_SEGMENT_SHIFT) - 1))
+
+// Money is held as a whole number of ngwee (K 1 = 100 ngwee). Print it with
+// printf("K " MONEY_FMT, MONEY_ARGS(amount)).
+#define MONEY_FMT "%s%lld.%02lld"
+#define MONEY_ARGS(ngwee) ((ngwee) < 0 ? "-" : ""), llabs(ngwee) / 100, llabs(ngwee) % 100
 
 // Structure definitions
+// In memory an account is split in two. The fields every scan touches
+// (number, balance, status) live in the dense accountNumbers,
+// accountBalances and accountActive columns; Account holds the cold rest.
+// Names are interned in the name pool, so Account only keeps a pointer.
+typedef struct {
+    const char *fullName;
+    char password[MAX_PASSWORD_LENGTH];
+} Account;
+
+// Name pool: each distinct holder name is stored once in a chain of
+// chunks. Entries never move, so Account.fullName stays valid until
+// freeNamePool(). folded holds a lowercase copy of data at the same
+// offsets, which substring searches scan with memmem.
+#define NAME_POOL_CHUNK_SIZE 65536
+typedef struct NameChunk {
+    struct NameChunk *next;
+    size_t used;
+    char data[NAME_POOL_CHUNK_SIZE];
+    char folded[NAME_POOL_CHUNK_SIZE];
+} NameChunk;
+
+// One account as stored in the snapshot and the write-ahead log
+typedef struct {
+    char fullName[MAX_NAME_LENGTH];
+    long long accountNumber;
+    char password[MAX_PASSWORD_LENGTH];
+    long long balance;
+    int isActive;
+} AccountRecord;
+
+// Kinds of history record. The codes are stored in the history, so new
+// kinds go at the end.
+typedef enum {
+    TRANSACTION_OPENING,
+    TRANSACTION_DEPOSIT,
+    TRANSACTION_WITHDRAWAL,
+    TRANSACTION_TRANSFER,
+    TRANSACTION_TYPES
+} TransactionType;
+
+// One history record as the program handles it. On disk it is encoded
+// in a few bytes (see encodeTransaction).
+typedef struct {
+    long long accountNumber;
+    long long amount;
+    long long balanceAfter;
+    time_t timestamp;
+    long long targetAccount;
+    TransactionType type;
+} Transaction;
+
+// Leading header of the snapshot, write-ahead log and history files.
+// Files from before version 2 have no header and store money as double.
+typedef struct {
+    unsigned int magic;
+    int version;
+} FileHeader;
+
+// Header of a version 3 snapshot; it starts with the FileHeader fields.
+// The records follow, checksummed in blocks of blockSize bytes, then a
+// table of blockCount CRC32C values, one per block.
+typedef struct {
+    unsigned int magic;
+    int version;
+    int recordSize;
+    int recordCount;
+    int blockSize;
+    int blockCount;
+    unsigned int tableCrc;   // CRC32C of the block checksum table
+    unsigned int headerCrc;  // CRC32C of the fields above
+} SnapshotHeader;
+
+// In-memory partition of one snapshot shard: the positions of the
+// accounts whose number hashes to it (see accountShard), and whether any
+// of them changed since the shard file was last written.
+typedef struct {
+    int *positions;
+    int count;
+    int capacity;
+    int dirty;
+} AccountShard;
+
+// Leading header of each history segment. Segments cover consecutive
+// stretches of the log, each at most one day and historySegmentMaxBytes
+// long. baseTimestamp is the first record's timestamp, written with that
+// record; record timestamps are stored relative to it. Record count, data
+// size and timestamp range are written when a segment is closed, so the
+// last segment is always rescanned on startup.
+typedef struct {
+    unsigned int magic;
+    int version;
+    int segmentNumber;
+    int recordCount;
+    long long minTimestamp;
+    long long maxTimestamp;
+    long long baseTimestamp;
+    long long dataBytes;
+} SegmentHeader;
+
+// Version 1 layouts, read only to migrate old files
 typedef struct {
     char fullName[MAX_NAME_LENGTH];
     long long accountNumber;
     char password[MAX_PASSWORD_LENGTH];
     double balance;
     int isActive;
-} Account;
+} LegacyAccount;
 
 typedef struct {
     long long accountNumber;
@@ -26,26 +212,356 @@ typedef struct {
     double balanceAfter;
     time_t timestamp;
     long long targetAccount;
-} Transaction;
+} LegacyTransaction;
+
+// Version 2 history layouts: fixed-size records with the type spelled
+// out, read only to convert old files
+typedef struct {
+    long long accountNumber;
+    char transactionType[20];
+    long long amount;
+    long long balanceAfter;
+    time_t timestamp;
+    long long targetAccount;
+} FixedTransaction;
+
+typedef struct {
+    unsigned int magic;
+    int version;
+    int segmentNumber;
+    int recordCount;
+    long long minTimestamp;
+    long long maxTimestamp;
+} FixedSegmentHeader;
+
+typedef struct {
+    int batchRemaining;
+    LegacyAccount account;
+} LegacyWalRecord;
+
+// Sidecar entry for one Transaction record. historyOffset is a history
+// location (see HISTORY_LOCATION). Entries of the same account are
+// chained newest to oldest through previousEntry (-1 ends the chain).
+typedef struct {
+    long long accountNumber;
+    long historyOffset;
+    long previousEntry;
+} HistoryIndexEntry;
+
+// How hard a finished operation pushes its log records to disk
+typedef enum {
+    DURABILITY_FSYNC_EACH,  // fsync at the end of every operation
+    DURABILITY_GROUP,       // fsync every N records or M milliseconds
+    DURABILITY_OS           // leave flushing to the operating system
+} DurabilityMode;
+
+// Result of a core banking operation
+typedef enum {
+    BANK_OK,
+    BANK_ERR_NOT_FOUND,
+    BANK_ERR_RECIPIENT_NOT_FOUND,
+    BANK_ERR_SAME_ACCOUNT,
+    BANK_ERR_INVALID_AMOUNT,
+    BANK_ERR_INSUFFICIENT_FUNDS,
+    BANK_ERR_WRONG_PASSWORD,
+    BANK_ERR_INVALID_PASSWORD,
+    BANK_ERR_INVALID_NAME,
+    BANK_ERR_MINIMUM_DEPOSIT,
+    BANK_ERR_STORAGE,
+    BANK_ERR_ABORTED        // valid, but its all-or-nothing batch was rejected
+} BankStatus;
+
+// One row of a bulk transfer. status and the balances after the row are
+// filled in by performBulkTransfer.
+typedef struct {
+    int line;
+    long long fromAccount;
+    long long toAccount;
+    long long amount;
+    BankStatus status;
+    long long fromBalance;
+    long long toBalance;
+} BulkTransfer;
+
+// Redo record: the after-image of one changed account. Records written
+// together (e.g. both sides of a transfer) form a batch that is only
+// replayed if every record of the batch made it to disk.
+typedef struct {
+    int batchRemaining;
+    AccountRecord account;
+} WalRecord;
 
-// Dynamic array for accounts
+// Accounts, plus the hot columns parallel to it. These and the other
+// per-account columns live in reserved address space that grows in place
+// (see growAccountStorage), so an account's fields never move.
 Account *accounts = NULL;
+long long *accountNumbers = NULL;
+long long *accountBalances = NULL;
+unsigned char *accountActive = NULL;
 int accountCount = 0;
 int accountCapacity = 0;
 long long currentUserAccount = -1;
+int batchMode = 0;
+
+// scrypt work factor (log2 N) for new password hashes. Each hash takes
+// 128 * 8 * 2^cost bytes, 16 MiB at the default.
+int passwordHashCost = PASSWORD_HASH_DEFAULT_COST;
+
+// Hash index: account number -> position in accounts (open addressing, linear probing)
+#define INDEX_EMPTY_SLOT -1
+int *accountIndexSlots = NULL;
+int accountIndexCapacity = 0;
+
+// Name index: the position of every account, sorted by holder name
+// ignoring case, then by account number. It has accountCapacity slots, so
+// adding an account never allocates. Guarded by accountsLock.
+int *nameIndex = NULL;
+int nameIndexCount = 0;
+
+// Account number allocator: one bit per number in the 33xxxxxx range,
+// set when the number is taken, and the next permutation position to try
+unsigned char accountNumberMap[ACCOUNT_NUMBER_RANGE / 8];
+int accountNumberCursor = 0;
+pthread_mutex_t accountNumberLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Name pool state (open addressing over pointers into the chunks)
+NameChunk *nameChunks = NULL;
+const char **nameSlots = NULL;
+int nameSlotCapacity = 0;
+int nameCount = 0;
+
+// Offset of each account's newest HistoryIndexEntry, parallel to accounts
+long *historyHeads = NULL;
+
+// Bank statistics, kept up to date as balances change so the admin panel
+// never scans the book. Only active accounts are counted. The max-heap
+// holds each active account's balance as the statistics last saw it, so
+// it never reads a balance another thread is changing; heapSlots
+// (parallel to accounts) is each account's place in it, or -1.
+// statsLock is a leaf: no other lock is taken while it is held.
+typedef struct {
+    long long balance;
+    int position;
+} BalanceHeapEntry;
+
+typedef enum {
+    VOLUME_DEPOSIT,
+    VOLUME_WITHDRAWAL,
+    VOLUME_TRANSFER,
+    VOLUME_KINDS
+} VolumeKind;
+
+pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+long long statsTotalBalance = 0;
+int statsActiveAccounts = 0;
+int balanceBuckets[BALANCE_BUCKETS];
+BalanceHeapEntry *balanceHeap = NULL;
+int balanceHeapSize = 0;
+int *heapSlots = NULL;
+int volumeDay = -1;
+long long volumeCounts[VOLUME_KINDS];
+long long volumeAmounts[VOLUME_KINDS];
+
+// Transaction appender: history and index files stay open and buffered,
+// and records are pushed to disk in groups according to durabilityMode
+FILE *historyAppendFile = NULL;
+FILE *indexAppendFile = NULL;
+long historyEndOffset = 0;
+long indexEndOffset = 0;
+DurabilityMode durabilityMode = DURABILITY_FSYNC_EACH;
+int groupCommitRecords = GROUP_COMMIT_RECORDS;
+int groupCommitIntervalMs = GROUP_COMMIT_INTERVAL_MS;
+int uncommittedRecords = 0;
+long long lastCommitMs = 0;
+long long appendedRecordCount = 0;
+long long committedRecordCount = 0;
+long long fsyncCount = 0;
+long long commitCount = 0;
+// History segments: historySegments[i] is the header of segment i, kept
+// current for the active (last) segment as records are appended.
+// Guarded by logLock.
+SegmentHeader *historySegments = NULL;
+int historySegmentCount = 0;
+int historySegmentCapacity = 0;
+long historySegmentMaxBytes = HISTORY_SEGMENT_MAX_BYTES;
+time_t activeSegmentDayEnd = 0;
+// Bytes handed to the snapshot, WAL, history and index files
+long long bytesWritten = 0;
+
+const char *transactionTypeNames[TRANSACTION_TYPES] = {"OPENING", "DEPOSIT", "WITHDRAWAL", "TRANSFER"};
+// Seconds between metrics dumps; 0 turns the dumps off
+int metricsDumpInterval = METRICS_DEFAULT_INTERVAL;
+
+// Write-ahead log state
+FILE *walFile = NULL;
+int walRecordCount = 0;
+long walFileSize = 0;
+int checkpointPending = 0;
+int legacyDataLoaded = 0;
+
+// Snapshot shards. Each shard has its own snapshot file, and a checkpoint
+// rewrites only the dirty ones, so a deposit never causes another shard's
+// file to be written. The write-ahead log stays shared, which keeps a
+// transfer between shards one atomic batch. The position lists change
+// with accountsLock held for writing; dirty is set under logLock (or that
+// write lock) and cleared by checkpoints.
+AccountShard accountShards[ACCOUNT_SHARDS];
+
+// Locking. accountsLock guards the shape of the book (the accounts array,
+// the index and historyHeads): operations hold it for reading, addAccount
+// and checkpoints take it for writing. Balances and passwords are guarded
+// by striped per-account mutexes, and logLock serializes the log files.
+// Lock order: accountsLock, then account stripes in ascending order, then
+// logLock.
+pthread_rwlock_t accountsLock;
+pthread_mutex_t accountLocks[ACCOUNT_LOCK_STRIPES];
+pthread_mutex_t logLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Book snapshots (see takeBookSnapshot). pendingSnapshot is set and
+// cleared with every account stripe held, so a writer holding a stripe
+// can read it; the copied flags are guarded by snapshotPageLock, a leaf
+// taken while holding a stripe. snapshotTakeLock lets one snapshot copy
+// at a time.
+typedef struct {
+    int count;
+    long long *numbers;
+    long long *balances;
+    unsigned char *active;
+    const char **names;
+    long long statisticsTotal;
+} BookSnapshot;
+
+pthread_mutex_t snapshotTakeLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t snapshotPageLock = PTHREAD_MUTEX_INITIALIZER;
+BookSnapshot *pendingSnapshot = NULL;
+unsigned char *snapshotPagesCopied = NULL;
+
+// Persistence writer. Every logged operation takes a ticket from
+// loggedOperations (under logLock); the writer thread syncs the log files
+// off the operation's path and publishes the last durable ticket in
+// persistDurable, so an operation waits only if its mode asks for it. A
+// pass that fails publishes its tickets, after persistFailedFrom up to
+// persistFailedThrough, so their operations report BANK_ERR_STORAGE.
+// persistLock may be taken while holding logLock, never the other way.
+pthread_mutex_t persistLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t persistWork = PTHREAD_COND_INITIALIZER;
+pthread_cond_t persistDone = PTHREAD_COND_INITIALIZER;
+pthread_t persistWriter;
+int persistWriterRunning = 0;
+int persistWriterStop = 0;
+long long persistRequested = 0;
+long long persistDurable = 0;
+long long persistFailedFrom = 0;
+long long persistFailedThrough = 0;
+long long loggedOperations = 0;
+// The writer's copy of the commit settings, refreshed on every pass
+int persistGroupMode = 0;
+int persistIntervalMs = GROUP_COMMIT_INTERVAL_MS;
+
+// Instrumentation probes. A function starts with METRIC_SCOPE to have its
+// latency recorded when it returns; METRIC_IO and METRIC_SYNC count calls
+// and bytes per file. Building with -DBANK_NO_METRICS removes every probe.
+typedef enum {
+    METRIC_ACCOUNT_LOOKUP,
+    METRIC_VERIFY_PASSWORD,
+    METRIC_APPEND_TRANSACTION,
+    METRIC_COMMIT,
+    METRIC_WAL_APPEND,
+    METRIC_SAVE_SNAPSHOT,
+    METRIC_LOAD_SNAPSHOT,
+    METRIC_OPERATIONS
+} MetricId;
+
+typedef enum {
+    IO_SNAPSHOT,
+    IO_WAL,
+    IO_HISTORY,
+    IO_INDEX,
+    IO_FILES
+} IoFile;
+
+#ifndef BANK_NO_METRICS
+typedef struct {
+    MetricId id;
+    long long startNs;  // 0 when this call is not sampled
+    unsigned int weight;
+} MetricScope;
+
+void endMetricScope(MetricScope *scope);
+void recordIo(IoFile file, int write, long long bytes);
+void recordSync(IoFile file);
+
+// sampleMask 0 times every call; 63 times one call in 64 per thread and
+// counts calls in steps of 64, for paths too short to time each call.
+#define METRIC_SCOPE(id, sampleMask) \
+    static __thread unsigned int metricTick; \
+    MetricScope metricScope __attribute__((cleanup(endMetricScope), unused)) = \
+        {(id), ((metricTick++ & (sampleMask)) == 0) ? currentTimeNs() : 0, (sampleMask) + 1}
+#define METRIC_IO(file, write, bytes) recordIo((file), (write), (bytes))
+#define METRIC_SYNC(file) recordSync(file)
+#else
+#define METRIC_SCOPE(id, sampleMask)
+#define METRIC_IO(file, write, bytes) ((void)0)
+#define METRIC_SYNC(file) ((void)0)
+#endif
 
 // Function prototypes
 void initializeSystem();
-void saveDataToFile();
+int saveDataToFile();
 void loadDataFromFile();
-void saveTransaction(long long accNum, const char* type, double amount, double newBalance, long long targetAcc);
-void displayTransactionHistory(long long accNum);
+void openWriteAheadLog();
+void replayWriteAheadLog();
+void abandonWriteAheadLog();
+int logAccountChanges(const int *positions, int count);
+int checkpoint();
+long long saveTransaction(long long accNum, TransactionType type, long long amount, long long newBalance, long long targetAcc);
+void appendTransaction(long long accNum, TransactionType type, long long amount, long long newBalance, long long targetAcc);
+void openTransactionAppender();
+void flushTransactionAppender();
+long long commitOperation();
+int commitPendingWrites();
+int awaitCommit(long long ticket);
+void wakePersistenceWriter();
+void startPersistenceWriter();
+void stopPersistenceWriter();
+void closeTransactionAppender();
+void displayAppenderStatistics();
+void displayTransactionHistory(long long accNum, int limit);
+void displayTransactionRange(long long accNum, time_t from, time_t to, int limit);
+void displayHistoryReport();
+long long currentTimeNs();
+void displayMetrics();
+void startMetricsDumper();
+void stopMetricsDumper();
+void runStatementJob();
+void loadHistoryIndex();
+void appendHistoryIndexEntry(long long accNum, long historyOffset);
+void historySegmentName(int segment, char *name, size_t size);
+int readTransactionHistory(long long accNum, int limit, Transaction **records);
+int readTransactionRange(long long accNum, time_t from, time_t to, int limit, Transaction **records);
+void removeHistorySegments();
 void clearInputBuffer();
 
+const char *bankStatusName(BankStatus status);
+BankStatus performRegistration(const char *name, const char *password, long long initialDeposit, long long *accNum);
+BankStatus performLogin(long long accNum, const char *password, int *position);
+BankStatus performDeposit(long long accNum, long long amount);
+BankStatus performWithdrawal(long long accNum, long long amount);
+BankStatus performTransfer(long long fromAcc, long long toAcc, long long amount);
+BankStatus performPasswordChange(long long accNum, const char *currentPassword, const char *newPassword);
+void undoBulkTransfers(BulkTransfer *transfers, int count, BankStatus status);
+int performBulkTransfer(BulkTransfer *transfers, int count, int allOrNothing);
+int loadBulkTransfers(const char *path, BulkTransfer **transfers);
+void runBulkTransferJob();
+int runBatch(FILE *input);
+int runStressTest(int threadCount, int opsPerThread);
+void initializeLocks();
+
 void displayWelcomeScreen();
 void mainMenu();
 void userRegistration();
 int userLogin();
+void printTransactionError(BankStatus status, const char *operation, long long balance);
 void depositFunds();
 void withdrawFunds();
 void transferFunds();
@@ -57,11 +573,40 @@ void clearScreen();
 void pauseScreen();
 int validatePassword(const char* password);
 int validateName(const char* name);
-void generateAccountNumber(char* accNum);
+long long allocateAccountNumber();
+void reserveAccountNumber(long long accNum);
+void resetAccountNumbers();
 void encryptPassword(char* password);
 int verifyPassword(const char* input, const char* stored);
-void displayBalance(double balance);
-void addAccount(Account newAccount);
+int hashPassword(const char *password, char *stored);
+int passwordNeedsRehash(const char *stored);
+void displayBalance(long long balance);
+int parseMoney(const char *text, long long *ngwee);
+long long readMoney();
+int parseDateRange(const char *fromText, const char *toText, time_t *from, time_t *to);
+int readDateRange(time_t *from, time_t *to);
+time_t nextLocalMidnight(time_t t);
+int addAccount(const AccountRecord *record);
+int storeAccountRecord(int position, const AccountRecord *record);
+void updateAccountStatistics(int position, long long balance, int active);
+void updateChangedStatistics(const int *positions, int count);
+void recordDailyVolume(VolumeKind kind, long long amount);
+void resetBankStatistics();
+void displayBankStatistics();
+const char *internName(const char *name);
+void freeNamePool();
+void loadAccountRecord(int position, AccountRecord *record);
+void computeBankTotals(const BookSnapshot *snapshot, long long *totalBalance, int *activeAccounts);
+BookSnapshot *takeBookSnapshot();
+void freeBookSnapshot(BookSnapshot *snapshot);
+void preserveAccount(int position);
+int findAccountIndex(long long accNum);
+int findNextAccountIndex(long long accNum, int after);
+void indexAccount(int position);
+void rebuildAccountIndex();
+void indexAccountName(int position);
+void unindexAccountName(int position);
+void rebuildNameIndex();
 
 // Utility functions
 void clearScreen() {
@@ -108,171 +653,5122 @@ int validateName(const char* name) {
     return 1;
 }
 
-void generateAccountNumber(char* accNum) {
-    srand(time(NULL));
-    sprintf(accNum, "33%06d", rand() % 1000000);
+// Account number allocation
+// New numbers come from a fixed permutation of the 33xxxxxx range,
+// position i -> (i * ACCOUNT_NUMBER_MULTIPLIER + ACCOUNT_NUMBER_OFFSET)
+// mod range, which is a bijection because the multiplier is coprime to
+// 10^6. Numbers already taken are skipped by one bit test each; the
+// cursor never moves back, so each allocation is amortized O(1).
+int testAndSetAccountNumber(long long accNum) {
+    long long slot = accNum - ACCOUNT_NUMBER_BASE;
+    if (slot < 0 || slot >= ACCOUNT_NUMBER_RANGE) return 0;
+    unsigned char bit = (unsigned char)(1u << (slot & 7));
+    int wasTaken = (accountNumberMap[slot >> 3] & bit) != 0;
+    accountNumberMap[slot >> 3] |= bit;
+    return wasTaken;
 }
 
-void encryptPassword(char* password) {
-    char key = 'M';
-    for (int i = 0; password[i] != '\0'; i++) {
-        password[i] = password[i] ^ key;
+// Returns an account number no account has, or -1 if the range is used up.
+long long allocateAccountNumber() {
+    long long accNum = -1;
+    pthread_mutex_lock(&accountNumberLock);
+    while (accountNumberCursor < ACCOUNT_NUMBER_RANGE) {
+        long long slot = ((long long)accountNumberCursor++ * ACCOUNT_NUMBER_MULTIPLIER + ACCOUNT_NUMBER_OFFSET) %
+                         ACCOUNT_NUMBER_RANGE;
+        if (!testAndSetAccountNumber(ACCOUNT_NUMBER_BASE + slot)) {
+            accNum = ACCOUNT_NUMBER_BASE + slot;
+            break;
+        }
     }
+    pthread_mutex_unlock(&accountNumberLock);
+    return accNum;
 }
 
-int verifyPassword(const char* input, const char* stored) {
-    char encryptedInput[MAX_PASSWORD_LENGTH];
-    strcpy(encryptedInput, input);
-    encryptPassword(encryptedInput);
-    return strcmp(encryptedInput, stored) == 0;
+// Marks a number as taken by an account that did not get it from
+// allocateAccountNumber (loaded, replayed or synthetic accounts).
+void reserveAccountNumber(long long accNum) {
+    pthread_mutex_lock(&accountNumberLock);
+    testAndSetAccountNumber(accNum);
+    pthread_mutex_unlock(&accountNumberLock);
 }
 
-void displayBalance(double balance) {
-    printf("Current Balance: K %.2f\n", balance);
+void resetAccountNumbers() {
+    pthread_mutex_lock(&accountNumberLock);
+    memset(accountNumberMap, 0, sizeof(accountNumberMap));
+    accountNumberCursor = 0;
+    pthread_mutex_unlock(&accountNumberLock);
 }
 
-void addAccount(Account newAccount) {
-    if (accountCount >= accountCapacity) {
-        int newCapacity = (accountCapacity == 0) ? 10 : accountCapacity * 2;
-        Account *newAccounts = realloc(accounts, newCapacity * sizeof(Account));
-        
-        if (newAccounts == NULL) {
-            printf("Error: Memory allocation failed. Cannot create account.\n");
-            return;
-        }
-        
-        accounts = newAccounts;
-        accountCapacity = newCapacity;
+// Password hashing
+// Passwords are stored as scrypt hashes in a crypt-style string that fits
+// the 50-byte password field:
+//   "G" "s" <log2 N> <r> <16 chars salt> <28 chars hash>
+// each field in the ./0-9A-Za-z alphabet (12 salt bytes, 21 hash bytes).
+// Older files hold the password XORed with 'M'. Input never contains a
+// newline, and '\n' ^ 'M' is 'G', so no old hash can start with 'G'.
+// Old hashes and hashes with a cost below passwordHashCost are rewritten
+// on the next successful login.
+#define PASSWORD_HASH_MARKER 'G'
+#define PASSWORD_HASH_SCHEME 's'
+#define PASSWORD_HASH_BLOCK_SIZE 8
+#define PASSWORD_HASH_MAX_BLOCK_SIZE 32
+#define PASSWORD_SALT_BYTES 12
+#define PASSWORD_KEY_BYTES 21
+#define PASSWORD_HASH_LENGTH 48
+
+const char hashAlphabet[] = "./0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char buffer[64];
+    size_t used;
+} Sha256;
+
+const uint32_t sha256RoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+void sha256Block(Sha256 *ctx, const unsigned char *block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+               ((uint32_t)block[i * 4 + 2] << 8) | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
     }
     
-    accounts[accountCount++] = newAccount;
+    uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2], d = ctx->state[3];
+    uint32_t e = ctx->state[4], f = ctx->state[5], g = ctx->state[6], h = ctx->state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + ((e & f) ^ (~e & g)) +
+                      sha256RoundConstants[i] + w[i];
+        uint32_t t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
+    ctx->state[4] += e; ctx->state[5] += f; ctx->state[6] += g; ctx->state[7] += h;
 }
 
-// File handling functions
-void saveDataToFile() {
-    FILE *file = fopen(FILENAME, "wb");
-    if (file == NULL) {
-        printf("Error: Could not save data to file.\n");
-        return;
+void sha256Init(Sha256 *ctx) {
+    const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->length = 0;
+    ctx->used = 0;
+}
+
+void sha256Update(Sha256 *ctx, const unsigned char *data, size_t length) {
+    ctx->length += length;
+    while (length > 0) {
+        size_t take = 64 - ctx->used;
+        if (take > length) take = length;
+        memcpy(ctx->buffer + ctx->used, data, take);
+        ctx->used += take;
+        data += take;
+        length -= take;
+        if (ctx->used == 64) {
+            sha256Block(ctx, ctx->buffer);
+            ctx->used = 0;
+        }
+    }
+}
+
+void sha256Final(Sha256 *ctx, unsigned char *digest) {
+    uint64_t bits = ctx->length * 8;
+    unsigned char padding = 0x80;
+    sha256Update(ctx, &padding, 1);
+    padding = 0;
+    while (ctx->used != 56) {
+        sha256Update(ctx, &padding, 1);
+    }
+    unsigned char lengthBytes[8];
+    for (int i = 0; i < 8; i++) {
+        lengthBytes[i] = (unsigned char)(bits >> (56 - 8 * i));
+    }
+    sha256Update(ctx, lengthBytes, 8);
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = (unsigned char)(ctx->state[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char)(ctx->state[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char)(ctx->state[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char)ctx->state[i];
+    }
+}
+
+// PBKDF2-HMAC-SHA256 (RFC 8018) with the key, as scrypt uses it
+void pbkdf2Sha256(const unsigned char *key, size_t keyLength, const unsigned char *salt, size_t saltLength,
+                  unsigned char *output, size_t outputLength) {
+    unsigned char keyBlock[64] = {0};
+    if (keyLength > 64) {
+        Sha256 ctx;
+        sha256Init(&ctx);
+        sha256Update(&ctx, key, keyLength);
+        sha256Final(&ctx, keyBlock);
+    } else {
+        memcpy(keyBlock, key, keyLength);
+    }
+    unsigned char innerPad[64], outerPad[64];
+    for (int i = 0; i < 64; i++) {
+        innerPad[i] = keyBlock[i] ^ 0x36;
+        outerPad[i] = keyBlock[i] ^ 0x5c;
     }
     
-    fwrite(&accountCount, sizeof(int), 1, file);
-    for (int i = 0; i < accountCount; i++) {
-        fwrite(&accounts[i], sizeof(Account), 1, file);
+    // scrypt only ever needs one iteration, so U1 is the block
+    for (uint32_t blockIndex = 1; outputLength > 0; blockIndex++) {
+        unsigned char counter[4] = {
+            (unsigned char)(blockIndex >> 24), (unsigned char)(blockIndex >> 16),
+            (unsigned char)(blockIndex >> 8), (unsigned char)blockIndex
+        };
+        unsigned char digest[32];
+        Sha256 ctx;
+        sha256Init(&ctx);
+        sha256Update(&ctx, innerPad, 64);
+        sha256Update(&ctx, salt, saltLength);
+        sha256Update(&ctx, counter, 4);
+        sha256Final(&ctx, digest);
+        sha256Init(&ctx);
+        sha256Update(&ctx, outerPad, 64);
+        sha256Update(&ctx, digest, 32);
+        sha256Final(&ctx, digest);
+        
+        size_t take = (outputLength < 32) ? outputLength : 32;
+        memcpy(output, digest, take);
+        output += take;
+        outputLength -= take;
     }
-    fclose(file);
 }
 
-void loadDataFromFile() {
-    FILE *file = fopen(FILENAME, "rb");
-    if (file == NULL) {
-        printf("No existing data found. Starting fresh.\n");
-        return;
+void salsa20_8(uint32_t block[16]) {
+    uint32_t x[16];
+    memcpy(x, block, sizeof(x));
+    for (int i = 0; i < 8; i += 2) {
+        x[4] ^= ROTL32(x[0] + x[12], 7);   x[8] ^= ROTL32(x[4] + x[0], 9);
+        x[12] ^= ROTL32(x[8] + x[4], 13);  x[0] ^= ROTL32(x[12] + x[8], 18);
+        x[9] ^= ROTL32(x[5] + x[1], 7);    x[13] ^= ROTL32(x[9] + x[5], 9);
+        x[1] ^= ROTL32(x[13] + x[9], 13);  x[5] ^= ROTL32(x[1] + x[13], 18);
+        x[14] ^= ROTL32(x[10] + x[6], 7);  x[2] ^= ROTL32(x[14] + x[10], 9);
+        x[6] ^= ROTL32(x[2] + x[14], 13);  x[10] ^= ROTL32(x[6] + x[2], 18);
+        x[3] ^= ROTL32(x[15] + x[11], 7);  x[7] ^= ROTL32(x[3] + x[15], 9);
+        x[11] ^= ROTL32(x[7] + x[3], 13);  x[15] ^= ROTL32(x[11] + x[7], 18);
+        x[1] ^= ROTL32(x[0] + x[3], 7);    x[2] ^= ROTL32(x[1] + x[0], 9);
+        x[3] ^= ROTL32(x[2] + x[1], 13);   x[0] ^= ROTL32(x[3] + x[2], 18);
+        x[6] ^= ROTL32(x[5] + x[4], 7);    x[7] ^= ROTL32(x[6] + x[5], 9);
+        x[4] ^= ROTL32(x[7] + x[6], 13);   x[5] ^= ROTL32(x[4] + x[7], 18);
+        x[11] ^= ROTL32(x[10] + x[9], 7);  x[8] ^= ROTL32(x[11] + x[10], 9);
+        x[9] ^= ROTL32(x[8] + x[11], 13);  x[10] ^= ROTL32(x[9] + x[8], 18);
+        x[12] ^= ROTL32(x[15] + x[14], 7); x[13] ^= ROTL32(x[12] + x[15], 9);
+        x[14] ^= ROTL32(x[13] + x[12], 13); x[15] ^= ROTL32(x[14] + x[13], 18);
+    }
+    for (int i = 0; i < 16; i++) {
+        block[i] += x[i];
+    }
+}
+
+// scrypt BlockMix over 2r 64-byte blocks; output goes to out
+void scryptBlockMix(const uint32_t *in, uint32_t *out, int r) {
+    uint32_t x[16];
+    memcpy(x, in + (2 * r - 1) * 16, sizeof(x));
+    for (int i = 0; i < 2 * r; i++) {
+        for (int j = 0; j < 16; j++) {
+            x[j] ^= in[i * 16 + j];
+        }
+        salsa20_8(x);
+        // Even blocks go to the first half, odd blocks to the second
+        memcpy(out + ((i / 2) + (i % 2) * r) * 16, x, sizeof(x));
+    }
+}
+
+// scrypt (RFC 7914) with p = 1. Returns 0 if the work area cannot be
+// allocated.
+int scrypt(const char *password, const unsigned char *salt, size_t saltLength,
+           int logN, int r, unsigned char *output, size_t outputLength) {
+    size_t blockWords = 32 * (size_t)r;
+    size_t n = (size_t)1 << logN;
+    uint32_t *v = malloc(n * blockWords * sizeof(uint32_t));
+    uint32_t *x = malloc(2 * blockWords * sizeof(uint32_t));
+    unsigned char *bytes = malloc(blockWords * 4);
+    if (v == NULL || x == NULL || bytes == NULL) {
+        free(v);
+        free(x);
+        free(bytes);
+        return 0;
     }
     
-    int savedCount;
-    fread(&savedCount, sizeof(int), 1, file);
+    pbkdf2Sha256((const unsigned char *)password, strlen(password), salt, saltLength, bytes, blockWords * 4);
+    for (size_t i = 0; i < blockWords; i++) {
+        x[i] = (uint32_t)bytes[i * 4] | ((uint32_t)bytes[i * 4 + 1] << 8) |
+               ((uint32_t)bytes[i * 4 + 2] << 16) | ((uint32_t)bytes[i * 4 + 3] << 24);
+    }
     
-    accounts = malloc(savedCount * sizeof(Account));
-    if (accounts == NULL) {
-        printf("Error: Memory allocation failed.\n");
-        fclose(file);
-        return;
+    uint32_t *y = x + blockWords;
+    for (size_t i = 0; i < n; i++) {
+        memcpy(v + i * blockWords, x, blockWords * sizeof(uint32_t));
+        scryptBlockMix(x, y, r);
+        memcpy(x, y, blockWords * sizeof(uint32_t));
+    }
+    for (size_t i = 0; i < n; i++) {
+        size_t j = x[(2 * r - 1) * 16] & (n - 1);
+        for (size_t k = 0; k < blockWords; k++) {
+            x[k] ^= v[j * blockWords + k];
+        }
+        scryptBlockMix(x, y, r);
+        memcpy(x, y, blockWords * sizeof(uint32_t));
     }
     
-    accountCapacity = savedCount;
-    accountCount = 0;
+    for (size_t i = 0; i < blockWords; i++) {
+        bytes[i * 4] = (unsigned char)x[i];
+        bytes[i * 4 + 1] = (unsigned char)(x[i] >> 8);
+        bytes[i * 4 + 2] = (unsigned char)(x[i] >> 16);
+        bytes[i * 4 + 3] = (unsigned char)(x[i] >> 24);
+    }
+    pbkdf2Sha256((const unsigned char *)password, strlen(password), bytes, blockWords * 4, output, outputLength);
     
-    for (int i = 0; i < savedCount; i++) {
-        Account acc;
-        if (fread(&acc, sizeof(Account), 1, file) == 1) {
-            addAccount(acc);
+    free(v);
+    free(x);
+    free(bytes);
+    return 1;
+}
+
+// Encodes length bytes (a multiple of 3) as 4 alphabet chars per 3 bytes
+void encodeHashBytes(const unsigned char *data, size_t length, char *text) {
+    for (size_t i = 0; i < length; i += 3) {
+        uint32_t group = ((uint32_t)data[i] << 16) | ((uint32_t)data[i + 1] << 8) | data[i + 2];
+        for (int j = 0; j < 4; j++) {
+            *text++ = hashAlphabet[(group >> (18 - 6 * j)) & 63];
         }
     }
-    
-    fclose(file);
-    printf("Loaded %d accounts from file.\n", accountCount);
 }
 
-void saveTransaction(long long accNum, const char* type, double amount, double newBalance, long long targetAcc) {
-    FILE *file = fopen(TRANSACTION_HISTORY_FILE, "ab");
-    if (file == NULL) return;
-    
-    Transaction trans;
-    trans.accountNumber = accNum;
-    strcpy(trans.transactionType, type);
-    trans.amount = amount;
-    trans.balanceAfter = newBalance;
-    trans.timestamp = time(NULL);
-    trans.targetAccount = targetAcc;
+int decodeHashChar(char c) {
+    const char *found = (c != '\0') ? strchr(hashAlphabet, c) : NULL;
+    return (found == NULL) ? -1 : (int)(found - hashAlphabet);
+}
+
+int decodeHashBytes(const char *text, unsigned char *data, size_t length) {
+    for (size_t i = 0; i < length; i += 3) {
+        uint32_t group = 0;
+        for (int j = 0; j < 4; j++) {
+            int value = decodeHashChar(*text++);
+            if (value < 0) return 0;
+            group = (group << 6) | (uint32_t)value;
+        }
+        data[i] = (unsigned char)(group >> 16);
+        data[i + 1] = (unsigned char)(group >> 8);
+        data[i + 2] = (unsigned char)group;
+    }
+    return 1;
+}
+
+// Compares without an early exit, so timing does not reveal where the
+// first mismatch is.
+int constantTimeEquals(const unsigned char *a, const unsigned char *b, size_t length) {
+    unsigned char difference = 0;
+    for (size_t i = 0; i < length; i++) {
+        difference |= a[i] ^ b[i];
+    }
+    return difference == 0;
+}
+
+int isLegacyPasswordHash(const char *stored) {
+    return stored[0] != PASSWORD_HASH_MARKER;
+}
+
+// Stored hashes that a login should rewrite: old XOR hashes, and scrypt
+// hashes made with less work than passwordHashCost.
+int passwordNeedsRehash(const char *stored) {
+    return isLegacyPasswordHash(stored) || decodeHashChar(stored[2]) < passwordHashCost;
+}
+
+// Hashes password with a fresh salt at the current cost into stored
+// (MAX_PASSWORD_LENGTH bytes). Returns 0 if no salt or memory was available.
+int hashPassword(const char *password, char *stored) {
+    unsigned char salt[PASSWORD_SALT_BYTES];
+    unsigned char key[PASSWORD_KEY_BYTES];
+    if (getrandom(salt, sizeof(salt), 0) != (ssize_t)sizeof(salt) ||
+        !scrypt(password, salt, sizeof(salt), passwordHashCost, PASSWORD_HASH_BLOCK_SIZE, key, sizeof(key))) {
+        return 0;
+    }
     
-    fwrite(&trans, sizeof(Transaction), 1, file);
-    fclose(file);
+    memset(stored, 0, MAX_PASSWORD_LENGTH);
+    stored[0] = PASSWORD_HASH_MARKER;
+    stored[1] = PASSWORD_HASH_SCHEME;
+    stored[2] = hashAlphabet[passwordHashCost];
+    stored[3] = hashAlphabet[PASSWORD_HASH_BLOCK_SIZE];
+    encodeHashBytes(salt, sizeof(salt), stored + 4);
+    encodeHashBytes(key, sizeof(key), stored + 4 + PASSWORD_SALT_BYTES / 3 * 4);
+    return 1;
 }
 
-void displayTransactionHistory(long long accNum) {
-    FILE *file = fopen(TRANSACTION_HISTORY_FILE, "rb");
-    if (file == NULL) {
-        printf("No transaction history found.\n");
-        return;
+// The version 1 scheme, kept only to check and upgrade old hashes.
+void encryptPassword(char* password) {
+    char key = 'M';
+    for (int i = 0; password[i] != '\0'; i++) {
+        password[i] = password[i] ^ key;
+    }
+}
+
+int verifyPassword(const char* input, const char* stored) {
+    METRIC_SCOPE(METRIC_VERIFY_PASSWORD, 0);
+    if (strlen(input) >= MAX_PASSWORD_LENGTH) {
+        return 0;
     }
     
-    printf("\n=== TRANSACTION HISTORY ===\n");
-    printf("Account: %lld\n\n", accNum);
+    if (isLegacyPasswordHash(stored)) {
+        // Both sides end at their first NUL, as strcmp used to treat them
+        char encryptedInput[MAX_PASSWORD_LENGTH] = {0};
+        char storedCopy[MAX_PASSWORD_LENGTH] = {0};
+        for (int i = 0; input[i] != '\0' && (input[i] ^ 'M') != 0; i++) {
+            encryptedInput[i] = input[i] ^ 'M';
+        }
+        strncpy(storedCopy, stored, MAX_PASSWORD_LENGTH - 1);
+        return constantTimeEquals((const unsigned char *)encryptedInput,
+                                  (const unsigned char *)storedCopy, MAX_PASSWORD_LENGTH);
+    }
     
-    Transaction trans;
-    int found = 0;
+    int logN = decodeHashChar(stored[2]);
+    int r = decodeHashChar(stored[3]);
+    unsigned char salt[PASSWORD_SALT_BYTES];
+    unsigned char expected[PASSWORD_KEY_BYTES];
+    unsigned char actual[PASSWORD_KEY_BYTES];
+    if (stored[1] != PASSWORD_HASH_SCHEME || logN < 1 || logN > PASSWORD_HASH_MAX_COST ||
+        r < 1 || r > PASSWORD_HASH_MAX_BLOCK_SIZE ||
+        !decodeHashBytes(stored + 4, salt, sizeof(salt)) ||
+        !decodeHashBytes(stored + 4 + PASSWORD_SALT_BYTES / 3 * 4, expected, sizeof(expected)) ||
+        !scrypt(input, salt, sizeof(salt), logN, r, actual, sizeof(actual))) {
+        return 0;
+    }
+    return constantTimeEquals(actual, expected, sizeof(actual));
+}
+
+void displayBalance(long long balance) {
+    printf("Current Balance: K " MONEY_FMT "\n", MONEY_ARGS(balance));
+}
+
+// Parses an amount in kwacha with at most two decimals ("150", "12.5",
+// "0.05") into ngwee without going through floating point. Returns 0 if
+// the text is not such an amount.
+int parseMoney(const char *text, long long *ngwee) {
+    long long whole = 0;
+    long long fraction = 0;
+    int digits = 0;
+    int fractionDigits = 0;
     
-    while (fread(&trans, sizeof(Transaction), 1, file)) {
-        if (trans.accountNumber == accNum) {
-            found = 1;
-            struct tm *timeinfo = localtime(&trans.timestamp);
-            printf("Date: %s", asctime(timeinfo));
-            printf("Type: %s\n", trans.transactionType);
-            printf("Amount: K %.2f\n", trans.amount);
-            
-            if (strcmp(trans.transactionType, "TRANSFER") == 0) {
-                if (trans.amount < 0) {
-                    printf("Transferred to: %lld\n", trans.targetAccount);
-                } else {
-                    printf("Received from: %lld\n", trans.targetAccount);
-                }
-            }
-            
-            printf("Balance After: K %.2f\n", trans.balanceAfter);
-            printf("---------------------------\n");
+    while (isspace((unsigned char)*text)) text++;
+    while (isdigit((unsigned char)*text)) {
+        if (++digits > 15) return 0;
+        whole = whole * 10 + (*text++ - '0');
+    }
+    if (*text == '.') {
+        text++;
+        while (isdigit((unsigned char)*text)) {
+            if (++fractionDigits > 2) return 0;
+            fraction = fraction * 10 + (*text++ - '0');
         }
+        if (fractionDigits == 1) fraction *= 10;
     }
+    while (isspace((unsigned char)*text)) text++;
     
-    if (!found) {
-        printf("No transactions found for this account.\n");
+    if (*text != '\0' || digits + fractionDigits == 0) {
+        return 0;
+    }
+    *ngwee = whole * 100 + fraction;
+    return 1;
+}
+
+// Reads an amount typed at a prompt; anything unparsable reads as 0 so the
+// caller's "must be positive" check rejects it.
+long long readMoney() {
+    char line[64];
+    long long ngwee = 0;
+    if (fgets(line, sizeof(line), stdin) == NULL) {
+        return 0;
+    }
+    if (strchr(line, '\n') == NULL) {
+        clearInputBuffer();
+    }
+    if (!parseMoney(line, &ngwee)) {
+        return 0;
+    }
+    return ngwee;
+}
+
+// Parses a local calendar day ("2026-10-17") into the time it starts.
+// Returns 0 if the text is not a real date.
+int parseDate(const char *text, time_t *dayStart) {
+    int year, month, day;
+    char extra;
+    if (sscanf(text, "%d-%d-%d %c", &year, &month, &day, &extra) != 3) {
+        return 0;
     }
     
-    fclose(file);
+    struct tm date;
+    memset(&date, 0, sizeof(date));
+    date.tm_year = year - 1900;
+    date.tm_mon = month - 1;
+    date.tm_mday = day;
+    date.tm_isdst = -1;
+    *dayStart = mktime(&date);
+    // mktime normalizes dates like 2026-02-30; reject those
+    return *dayStart != (time_t)-1 && date.tm_year == year - 1900 &&
+           date.tm_mon == month - 1 && date.tm_mday == day;
 }
 
-// Core banking functions
-void userRegistration() {
-    clearScreen();
-    printf("=== MISHTERIOUS BANK - ACCOUNT REGISTRATION ===\n\n");
+// Turns two dates into the range from the start of the first day to the
+// end of the last. Returns 0 if a date is invalid or the range is backwards.
+int parseDateRange(const char *fromText, const char *toText, time_t *from, time_t *to) {
+    time_t lastDay;
+    if (!parseDate(fromText, from) || !parseDate(toText, &lastDay) || lastDay < *from) {
+        return 0;
+    }
+    *to = nextLocalMidnight(lastDay) - 1;
+    return 1;
+}
+
+// Asks for an optional date range. Returns 1 with a range, 0 if the first
+// date was left blank, -1 if a date was invalid.
+int readDateRange(time_t *from, time_t *to) {
+    char fromText[32];
+    char toText[32];
+    printf("From date (YYYY-MM-DD, Enter for all): ");
+    if (fgets(fromText, sizeof(fromText), stdin) == NULL) {
+        return 0;
+    }
+    if (strchr(fromText, '\n') == NULL) {
+        clearInputBuffer();
+    }
+    fromText[strcspn(fromText, "\n")] = 0;
+    if (fromText[0] == '\0') {
+        return 0;
+    }
     
-    Account newAccount;
+    printf("To date (YYYY-MM-DD): ");
+    if (fgets(toText, sizeof(toText), stdin) == NULL) {
+        toText[0] = '\0';
+    } else if (strchr(toText, '\n') == NULL) {
+        clearInputBuffer();
+    }
+    toText[strcspn(toText, "\n")] = 0;
     
-    // Get full name
-    do {
-        printf("Enter Full Name: ");
-        fgets(newAccount.fullName, MAX_NAME_LENGTH, stdin);
-        newAccount.fullName[strcspn(newAccount.fullName, "\n")] = 0;
-        
-        if (!validateName(newAccount.fullName)) {
-            printf("Error: Invalid name. Use only letters, spaces, and dots.\n");
+    if (!parseDateRange(fromText, toText, from, to)) {
+        printf("Error: Enter dates as YYYY-MM-DD, the earlier one first.\n");
+        return -1;
+    }
+    return 1;
+}
+
+// Account index functions
+unsigned long long hashAccountNumber(long long accNum) {
+    unsigned long long h = (unsigned long long)accNum;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+int findAccountIndex(long long accNum) {
+    METRIC_SCOPE(METRIC_ACCOUNT_LOOKUP, METRIC_LOOKUP_SAMPLE_MASK);
+    if (accountIndexCapacity == 0) {
+        return -1;
+    }
+    
+    unsigned long long mask = accountIndexCapacity - 1;
+    unsigned long long slot = hashAccountNumber(accNum) & mask;
+    while (accountIndexSlots[slot] != INDEX_EMPTY_SLOT) {
+        int position = accountIndexSlots[slot];
+        if (accountNumbers[position] == accNum) {
+            return position;
         }
-    } while (!validateName(newAccount.fullName));
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
+// Returns the lowest position above after holding accNum, or -1. Legacy
+// files can hold several accounts with one number; login accepts any of
+// them, as the old front-to-back scan did.
+int findNextAccountIndex(long long accNum, int after) {
+    if (accountIndexCapacity == 0) {
+        return -1;
+    }
     
-    // Generate account number
-    char accNumStr[20];
-    generateAccountNumber(accNumStr);
-    newAccount.accountNumber = atoll(accNumStr);
+    int next = -1;
+    unsigned long long mask = accountIndexCapacity - 1;
+    unsigned long long slot = hashAccountNumber(accNum) & mask;
+    while (accountIndexSlots[slot] != INDEX_EMPTY_SLOT) {
+        int position = accountIndexSlots[slot];
+        if (accountNumbers[position] == accNum && position > after && (next == -1 || position < next)) {
+            next = position;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return next;
+}
+
+// Inserts accounts[position] without growing the table. Accounts are
+// inserted in position order, so of several with one number the first
+// sits earliest in the probe chain and findAccountIndex returns it, same
+// as the old front-to-back scans.
+void insertIntoIndex(int position) {
+    unsigned long long mask = accountIndexCapacity - 1;
+    unsigned long long slot = hashAccountNumber(accountNumbers[position]) & mask;
+    while (accountIndexSlots[slot] != INDEX_EMPTY_SLOT) {
+        slot = (slot + 1) & mask;
+    }
+    accountIndexSlots[slot] = position;
+}
+
+void rebuildAccountIndex() {
+    // Keep the load factor at or below 50% so probe chains stay short
+    int newCapacity = 16;
+    while (newCapacity < accountCount * 2) {
+        newCapacity *= 2;
+    }
+    
+    int *newSlots = malloc(newCapacity * sizeof(int));
+    if (newSlots == NULL) {
+        printf("Error: Memory allocation failed. Account index not rebuilt.\n");
+        return;
+    }
+    
+    free(accountIndexSlots);
+    accountIndexSlots = newSlots;
+    accountIndexCapacity = newCapacity;
+    for (int i = 0; i < accountIndexCapacity; i++) {
+        accountIndexSlots[i] = INDEX_EMPTY_SLOT;
+    }
+    for (int i = 0; i < accountCount; i++) {
+        insertIntoIndex(i);
+    }
+}
+
+void indexAccount(int position) {
+    if ((position + 1) * 2 > accountIndexCapacity) {
+        rebuildAccountIndex();
+        return;
+    }
+    insertIntoIndex(position);
+}
+
+// Name index functions
+// Orders (name, number) against the account at position. Interned names
+// are compared by pointer first, since equal names share one copy.
+int compareNameKey(const char *name, long long number, int position) {
+    const char *other = accounts[position].fullName;
+    int order = (name == other) ? 0 : strcasecmp(name, other);
+    if (order != 0) return order;
+    return (number > accountNumbers[position]) - (number < accountNumbers[position]);
+}
+
+int compareNameSlots(const void *a, const void *b) {
+    int position = *(const int *)a;
+    return compareNameKey(accounts[position].fullName, accountNumbers[position], *(const int *)b);
+}
+
+// First slot of the name index whose account does not sort before
+// (name, number)
+int seekNameIndex(const char *name, long long number) {
+    int low = 0;
+    int high = nameIndexCount;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (compareNameKey(name, number, nameIndex[middle]) > 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// First slot whose name starts with prefix or sorts after it
+int seekNamePrefix(const char *prefix, size_t length) {
+    int low = 0;
+    int high = nameIndexCount;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (strncasecmp(accounts[nameIndex[middle]].fullName, prefix, length) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+void indexAccountName(int position) {
+    int slot = seekNameIndex(accounts[position].fullName, accountNumbers[position]);
+    memmove(nameIndex + slot + 1, nameIndex + slot, (nameIndexCount - slot) * sizeof(int));
+    nameIndex[slot] = position;
+    nameIndexCount++;
+}
+
+void unindexAccountName(int position) {
+    int slot = seekNameIndex(accounts[position].fullName, accountNumbers[position]);
+    while (slot < nameIndexCount && nameIndex[slot] != position) {
+        slot++;
+    }
+    if (slot == nameIndexCount) return;
+    memmove(nameIndex + slot, nameIndex + slot + 1, (nameIndexCount - slot - 1) * sizeof(int));
+    nameIndexCount--;
+}
+
+void rebuildNameIndex() {
+    for (int i = 0; i < accountCount; i++) {
+        nameIndex[i] = i;
+    }
+    nameIndexCount = accountCount;
+    qsort(nameIndex, nameIndexCount, sizeof(int), compareNameSlots);
+}
+
+// Shard functions
+int accountShard(long long accNum) {
+    return (int)((hashAccountNumber(accNum) >> 32) % ACCOUNT_SHARDS);
+}
+
+int addToShard(int position) {
+    AccountShard *shard = &accountShards[accountShard(accountNumbers[position])];
+    if (shard->count == shard->capacity) {
+        int newCapacity = (shard->capacity == 0) ? 16 : shard->capacity * 2;
+        int *newPositions = realloc(shard->positions, newCapacity * sizeof(int));
+        if (newPositions == NULL) return 0;
+        shard->positions = newPositions;
+        shard->capacity = newCapacity;
+    }
+    shard->positions[shard->count++] = position;
+    shard->dirty = 1;
+    return 1;
+}
+
+void markShardsDirty(const int *positions, int count) {
+    for (int i = 0; i < count; i++) {
+        accountShards[accountShard(accountNumbers[positions[i]])].dirty = 1;
+    }
+}
+
+// Splits the loaded accounts into their shards. Returns 0 if memory ran out.
+int rebuildShards(int dirty) {
+    for (int i = 0; i < ACCOUNT_SHARDS; i++) {
+        accountShards[i].count = 0;
+    }
+    for (int i = 0; i < accountCount; i++) {
+        if (!addToShard(i)) return 0;
+    }
+    for (int i = 0; i < ACCOUNT_SHARDS; i++) {
+        accountShards[i].dirty = dirty;
+    }
+    return 1;
+}
+
+void freeShards() {
+    for (int i = 0; i < ACCOUNT_SHARDS; i++) {
+        free(accountShards[i].positions);
+        memset(&accountShards[i], 0, sizeof(AccountShard));
+    }
+}
+
+// Account storage
+// Each per-account column reserves address space for
+// ACCOUNT_STORAGE_LIMIT accounts when it is first needed and makes it
+// usable ACCOUNT_STORAGE_CHUNK accounts at a time. Growing never copies a
+// column or needs a second copy of it, and positions and pointers into
+// the columns stay valid; pages take memory only once they are written.
+// Returns the column (reserving it if column is NULL), or NULL on failure.
+void *commitColumn(void *column, size_t elementSize, int newCapacity) {
+    size_t from = 0;
+    int reserved = 0;
+    if (column == NULL) {
+        column = mmap(NULL, (size_t)ACCOUNT_STORAGE_LIMIT * elementSize, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (column == MAP_FAILED) return NULL;
+        reserved = 1;
+    } else {
+        from = (size_t)accountCapacity * elementSize;
+    }
+    size_t to = (size_t)newCapacity * elementSize;
+    if (to > from && mprotect((char *)column + from, to - from, PROT_READ | PROT_WRITE) != 0) {
+        if (reserved) munmap(column, (size_t)ACCOUNT_STORAGE_LIMIT * elementSize);
+        return NULL;
+    }
+    return column;
+}
+
+void releaseColumn(void *column, size_t elementSize) {
+    if (column != NULL) {
+        munmap(column, (size_t)ACCOUNT_STORAGE_LIMIT * elementSize);
+    }
+}
+
+// Makes room for at least newCapacity accounts, rounded up to whole chunks
+int growAccountStorage(int newCapacity) {
+    if (newCapacity > ACCOUNT_STORAGE_LIMIT) return 0;
+    newCapacity = (newCapacity + ACCOUNT_STORAGE_CHUNK - 1) / ACCOUNT_STORAGE_CHUNK * ACCOUNT_STORAGE_CHUNK;
+    if (newCapacity <= accountCapacity) return 1;
+    
+    Account *newAccounts = commitColumn(accounts, sizeof(Account), newCapacity);
+    if (newAccounts == NULL) return 0;
+    accounts = newAccounts;
+    
+    long long *newNumbers = commitColumn(accountNumbers, sizeof(long long), newCapacity);
+    if (newNumbers == NULL) return 0;
+    accountNumbers = newNumbers;
+    
+    long long *newBalances = commitColumn(accountBalances, sizeof(long long), newCapacity);
+    if (newBalances == NULL) return 0;
+    accountBalances = newBalances;
+    
+    unsigned char *newActive = commitColumn(accountActive, sizeof(unsigned char), newCapacity);
+    if (newActive == NULL) return 0;
+    accountActive = newActive;
+    
+    long *newHeads = commitColumn(historyHeads, sizeof(long), newCapacity);
+    if (newHeads == NULL) return 0;
+    historyHeads = newHeads;
+    
+    int *newSlots = commitColumn(heapSlots, sizeof(int), newCapacity);
+    if (newSlots == NULL) return 0;
+    heapSlots = newSlots;
+    
+    BalanceHeapEntry *newHeap = commitColumn(balanceHeap, sizeof(BalanceHeapEntry), newCapacity);
+    if (newHeap == NULL) return 0;
+    balanceHeap = newHeap;
+    
+    int *newNameIndex = commitColumn(nameIndex, sizeof(int), newCapacity);
+    if (newNameIndex == NULL) return 0;
+    nameIndex = newNameIndex;
+    
+    accountCapacity = newCapacity;
+    return 1;
+}
+
+void releaseAccountStorage() {
+    releaseColumn(accounts, sizeof(Account));
+    releaseColumn(accountNumbers, sizeof(long long));
+    releaseColumn(accountBalances, sizeof(long long));
+    releaseColumn(accountActive, sizeof(unsigned char));
+    releaseColumn(historyHeads, sizeof(long));
+    releaseColumn(heapSlots, sizeof(int));
+    releaseColumn(balanceHeap, sizeof(BalanceHeapEntry));
+    releaseColumn(nameIndex, sizeof(int));
+    accounts = NULL;
+    accountNumbers = NULL;
+    accountBalances = NULL;
+    accountActive = NULL;
+    historyHeads = NULL;
+    heapSlots = NULL;
+    balanceHeap = NULL;
+    nameIndex = NULL;
+    accountCapacity = 0;
+}
+
+// Name pool functions
+// Callers hold accountsLock, for writing to add names (or run before any
+// thread starts) and for reading to search them.
+unsigned long long hashName(const char *name) {
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    for (; *name != '\0'; name++) {
+        h ^= (unsigned char)*name;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+int growNameSlots() {
+    int newCapacity = (nameSlotCapacity == 0) ? 64 : nameSlotCapacity * 2;
+    const char **newSlots = calloc(newCapacity, sizeof(const char *));
+    if (newSlots == NULL) return 0;
+    
+    for (int i = 0; i < nameSlotCapacity; i++) {
+        if (nameSlots[i] == NULL) continue;
+        unsigned long long slot = hashName(nameSlots[i]) & (newCapacity - 1);
+        while (newSlots[slot] != NULL) {
+            slot = (slot + 1) & (newCapacity - 1);
+        }
+        newSlots[slot] = nameSlots[i];
+    }
+    free(nameSlots);
+    nameSlots = newSlots;
+    nameSlotCapacity = newCapacity;
+    return 1;
+}
+
+// Sizes the table for count more names up front, so a bulk load does not
+// rehash a full table at every doubling.
+int reserveNameSlots(int count) {
+    while ((nameCount + count) * 2 > nameSlotCapacity) {
+        if (!growNameSlots()) return 0;
+    }
+    return 1;
+}
+
+// Returns the pooled copy of name, adding it if it is new, or NULL if
+// memory ran out. Names longer than MAX_NAME_LENGTH - 1 are cut there.
+const char *internName(const char *name) {
+    char bounded[MAX_NAME_LENGTH];
+    size_t length = strnlen(name, MAX_NAME_LENGTH - 1);
+    memcpy(bounded, name, length);
+    bounded[length] = '\0';
+    
+    if ((nameCount + 1) * 2 > nameSlotCapacity && !growNameSlots()) {
+        return NULL;
+    }
+    
+    unsigned long long mask = nameSlotCapacity - 1;
+    unsigned long long slot = hashName(bounded) & mask;
+    while (nameSlots[slot] != NULL) {
+        if (strcmp(nameSlots[slot], bounded) == 0) {
+            return nameSlots[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+    
+    if (nameChunks == NULL || nameChunks->used + length + 1 > NAME_POOL_CHUNK_SIZE) {
+        NameChunk *chunk = malloc(sizeof(NameChunk));
+        if (chunk == NULL) return NULL;
+        chunk->next = nameChunks;
+        chunk->used = 0;
+        nameChunks = chunk;
+    }
+    char *copy = nameChunks->data + nameChunks->used;
+    memcpy(copy, bounded, length + 1);
+    char *folded = nameChunks->folded + nameChunks->used;
+    for (size_t i = 0; i <= length; i++) {
+        folded[i] = (char)tolower((unsigned char)bounded[i]);
+    }
+    nameChunks->used += length + 1;
+    
+    nameSlots[slot] = copy;
+    nameCount++;
+    return copy;
+}
+
+// Stores up to limit pooled names containing needle (already lowercase)
+// in names. Returns how many were found, or limit + 1 if there are more.
+int findPooledNames(const char *needle, size_t length, const char **names, int limit) {
+    int found = 0;
+    for (NameChunk *chunk = nameChunks; chunk != NULL; chunk = chunk->next) {
+        const char *folded = chunk->folded;
+        const char *end = folded + chunk->used;
+        const char *hit;
+        while (folded < end && (hit = memmem(folded, end - folded, needle, length)) != NULL) {
+            const char *start = hit;
+            while (start > chunk->folded && start[-1] != '\0') {
+                start--;
+            }
+            if (found == limit) return limit + 1;
+            names[found++] = chunk->data + (start - chunk->folded);
+            folded = hit + strlen(hit) + 1;
+        }
+    }
+    return found;
+}
+
+void freeNamePool() {
+    while (nameChunks != NULL) {
+        NameChunk *next = nameChunks->next;
+        free(nameChunks);
+        nameChunks = next;
+    }
+    free(nameSlots);
+    nameSlots = NULL;
+    nameSlotCapacity = 0;
+    nameCount = 0;
+}
+
+// Returns 0 if the name could not be pooled; the account is left unchanged.
+// Positions at or past accountCount are new accounts.
+int storeAccountRecord(int position, const AccountRecord *record) {
+    const char *name = internName(record->fullName);
+    if (name == NULL) return 0;
+    if (position >= accountCount) {
+        heapSlots[position] = -1;
+    }
+    // A replayed change may rename an account; move it in the name index
+    int renamed = position < nameIndexCount && accounts[position].fullName != name;
+    if (renamed) {
+        unindexAccountName(position);
+    }
+    updateAccountStatistics(position, record->balance, record->isActive);
+    accounts[position].fullName = name;
+    accountNumbers[position] = record->accountNumber;
+    memcpy(accounts[position].password, record->password, MAX_PASSWORD_LENGTH);
+    accountBalances[position] = record->balance;
+    accountActive[position] = record->isActive ? 1 : 0;
+    if (renamed) {
+        indexAccountName(position);
+    }
+    return 1;
+}
+
+void loadAccountRecord(int position, AccountRecord *record) {
+    memset(record, 0, sizeof(AccountRecord));
+    strncpy(record->fullName, accounts[position].fullName, MAX_NAME_LENGTH - 1);
+    record->accountNumber = accountNumbers[position];
+    memcpy(record->password, accounts[position].password, MAX_PASSWORD_LENGTH);
+    record->balance = accountBalances[position];
+    record->isActive = accountActive[position];
+}
+
+int addAccount(const AccountRecord *record) {
+    pthread_rwlock_wrlock(&accountsLock);
+    if (accountCount >= accountCapacity) {
+        if (!growAccountStorage(accountCapacity + ACCOUNT_STORAGE_CHUNK)) {
+            printf("Error: Memory allocation failed. Cannot create account.\n");
+            pthread_rwlock_unlock(&accountsLock);
+            return -1;
+        }
+    }
+    
+    historyHeads[accountCount] = -1;
+    if (!storeAccountRecord(accountCount, record) || !addToShard(accountCount)) {
+        printf("Error: Memory allocation failed. Cannot create account.\n");
+        pthread_rwlock_unlock(&accountsLock);
+        return -1;
+    }
+    accountCount++;
+    indexAccount(accountCount - 1);
+    indexAccountName(accountCount - 1);
+    reserveAccountNumber(record->accountNumber);
+    int position = accountCount - 1;
+    pthread_rwlock_unlock(&accountsLock);
+    return position;
+}
+
+// Aggregation functions
+// Sums the balances of active accounts exactly, in integer ngwee, over the
+// dense balance and status columns. The AVX2 kernel handles four accounts
+// per step; the portable loop is branchless so compilers can vectorize it.
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+void sumActiveBalancesAvx2(const long long *balances, const unsigned char *active, int count,
+                           long long *total, long long *activeCount) {
+    __m256i sums = _mm256_setzero_si256();
+    __m256i counts = _mm256_setzero_si256();
+    int i = 0;
+    
+    for (; i + 4 <= count; i += 4) {
+        int flags;
+        memcpy(&flags, active + i, sizeof(int));
+        __m256i flags64 = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(flags));
+        __m256i mask = _mm256_sub_epi64(_mm256_setzero_si256(), flags64);
+        __m256i values = _mm256_loadu_si256((const __m256i *)(balances + i));
+        sums = _mm256_add_epi64(sums, _mm256_and_si256(values, mask));
+        counts = _mm256_add_epi64(counts, flags64);
+    }
+    
+    long long sumLanes[4];
+    long long countLanes[4];
+    _mm256_storeu_si256((__m256i *)sumLanes, sums);
+    _mm256_storeu_si256((__m256i *)countLanes, counts);
+    long long sum = sumLanes[0] + sumLanes[1] + sumLanes[2] + sumLanes[3];
+    long long activeSum = countLanes[0] + countLanes[1] + countLanes[2] + countLanes[3];
+    
+    for (; i < count; i++) {
+        sum += balances[i] & -(long long)active[i];
+        activeSum += active[i];
+    }
+    *total = sum;
+    *activeCount = activeSum;
+}
+#endif
+
+void sumActiveBalances(const long long *balances, const unsigned char *active, int count,
+                       long long *total, long long *activeCount) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) {
+        sumActiveBalancesAvx2(balances, active, count, total, activeCount);
+        return;
+    }
+#endif
+    long long sum = 0;
+    long long activeSum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += balances[i] & -(long long)active[i];
+        activeSum += active[i];
+    }
+    *total = sum;
+    *activeCount = activeSum;
+}
+
+void computeBankTotals(const BookSnapshot *snapshot, long long *totalBalance, int *activeAccounts) {
+    long long activeCount;
+    sumActiveBalances(snapshot->balances, snapshot->active, snapshot->count, totalBalance, &activeCount);
+    *activeAccounts = (int)activeCount;
+}
+
+// Bank statistics functions
+// Bucket i holds balances below K 100 * 10^i; the last bucket has no cap.
+int balanceBucket(long long balance) {
+    long long limit = MINIMUM_OPENING_DEPOSIT;
+    int bucket = 0;
+    while (bucket < BALANCE_BUCKETS - 1 && balance >= limit) {
+        limit *= 10;
+        bucket++;
+    }
+    return bucket;
+}
+
+void swapHeapEntries(int a, int b) {
+    BalanceHeapEntry entry = balanceHeap[a];
+    balanceHeap[a] = balanceHeap[b];
+    balanceHeap[b] = entry;
+    heapSlots[balanceHeap[a].position] = a;
+    heapSlots[balanceHeap[b].position] = b;
+}
+
+void siftHeapEntry(int slot) {
+    while (slot > 0 && balanceHeap[(slot - 1) / 2].balance < balanceHeap[slot].balance) {
+        swapHeapEntries(slot, (slot - 1) / 2);
+        slot = (slot - 1) / 2;
+    }
+    for (;;) {
+        int largest = slot;
+        int left = slot * 2 + 1;
+        int right = left + 1;
+        if (left < balanceHeapSize && balanceHeap[left].balance > balanceHeap[largest].balance) largest = left;
+        if (right < balanceHeapSize && balanceHeap[right].balance > balanceHeap[largest].balance) largest = right;
+        if (largest == slot) break;
+        swapHeapEntries(slot, largest);
+        slot = largest;
+    }
+}
+
+// Records that the account at position now has this balance and status.
+// O(log n) for the heap; the totals and buckets are O(1). Callers hold
+// statsLock.
+void applyAccountStatistics(int position, long long balance, int active) {
+    int slot = heapSlots[position];
+    if (slot != -1) {
+        long long oldBalance = balanceHeap[slot].balance;
+        statsTotalBalance -= oldBalance;
+        balanceBuckets[balanceBucket(oldBalance)]--;
+        if (active) {
+            balanceHeap[slot].balance = balance;
+            siftHeapEntry(slot);
+        } else {
+            statsActiveAccounts--;
+            swapHeapEntries(slot, --balanceHeapSize);
+            heapSlots[position] = -1;
+            if (slot < balanceHeapSize) {
+                siftHeapEntry(slot);
+            }
+        }
+    } else if (active) {
+        statsActiveAccounts++;
+        slot = balanceHeapSize++;
+        balanceHeap[slot].balance = balance;
+        balanceHeap[slot].position = position;
+        heapSlots[position] = slot;
+        siftHeapEntry(slot);
+    }
+    if (active) {
+        statsTotalBalance += balance;
+        balanceBuckets[balanceBucket(balance)]++;
+    }
+}
+
+void updateAccountStatistics(int position, long long balance, int active) {
+    pthread_mutex_lock(&statsLock);
+    applyAccountStatistics(position, balance, active);
+    pthread_mutex_unlock(&statsLock);
+}
+
+// Records the current balances of several accounts in one step, so the
+// totals never show a transfer debited but not yet credited. Callers
+// hold the accounts' stripes.
+void updateChangedStatistics(const int *positions, int count) {
+    pthread_mutex_lock(&statsLock);
+    for (int i = 0; i < count; i++) {
+        applyAccountStatistics(positions[i], accountBalances[positions[i]], accountActive[positions[i]]);
+    }
+    pthread_mutex_unlock(&statsLock);
+}
+
+// Adds to today's volume; the counters start over when the date changes.
+void recordDailyVolume(VolumeKind kind, long long amount) {
+    time_t now = time(NULL);
+    struct tm local;
+    localtime_r(&now, &local);
+    int today = local.tm_year * 1000 + local.tm_yday;
+    
+    pthread_mutex_lock(&statsLock);
+    if (today != volumeDay) {
+        memset(volumeCounts, 0, sizeof(volumeCounts));
+        memset(volumeAmounts, 0, sizeof(volumeAmounts));
+        volumeDay = today;
+    }
+    volumeCounts[kind]++;
+    volumeAmounts[kind] += amount;
+    pthread_mutex_unlock(&statsLock);
+}
+
+// Copies the k largest heap entries, largest first, into top. The heap is
+// walked from the root keeping a frontier of at most k + 1 candidates, so
+// this costs O(k^2) comparisons whatever the size of the book.
+int topBalances(BalanceHeapEntry *top, int k) {
+    int frontier[TOP_ACCOUNTS * 2 + 1];
+    int frontierSize = 0;
+    int found = 0;
+    if (balanceHeapSize > 0) {
+        frontier[frontierSize++] = 0;
+    }
+    while (found < k && frontierSize > 0) {
+        int best = 0;
+        for (int i = 1; i < frontierSize; i++) {
+            if (balanceHeap[frontier[i]].balance > balanceHeap[frontier[best]].balance) best = i;
+        }
+        int slot = frontier[best];
+        frontier[best] = frontier[--frontierSize];
+        top[found++] = balanceHeap[slot];
+        for (int child = slot * 2 + 1; child <= slot * 2 + 2; child++) {
+            if (child < balanceHeapSize) {
+                frontier[frontierSize++] = child;
+            }
+        }
+    }
+    return found;
+}
+
+void resetBankStatistics() {
+    pthread_mutex_lock(&statsLock);
+    statsTotalBalance = 0;
+    statsActiveAccounts = 0;
+    balanceHeapSize = 0;
+    memset(balanceBuckets, 0, sizeof(balanceBuckets));
+    pthread_mutex_unlock(&statsLock);
+}
+
+void displayBankStatistics() {
+    BalanceHeapEntry top[TOP_ACCOUNTS];
+    int buckets[BALANCE_BUCKETS];
+    long long counts[VOLUME_KINDS];
+    long long amounts[VOLUME_KINDS];
+    
+    pthread_rwlock_rdlock(&accountsLock);
+    pthread_mutex_lock(&statsLock);
+    long long totalBalance = statsTotalBalance;
+    int activeAccounts = statsActiveAccounts;
+    int registered = accountCount;
+    int topCount = topBalances(top, TOP_ACCOUNTS);
+    memcpy(buckets, balanceBuckets, sizeof(buckets));
+    memcpy(counts, volumeCounts, sizeof(counts));
+    memcpy(amounts, volumeAmounts, sizeof(amounts));
+    time_t now = time(NULL);
+    struct tm local;
+    localtime_r(&now, &local);
+    if (volumeDay != local.tm_year * 1000 + local.tm_yday) {
+        memset(counts, 0, sizeof(counts));
+        memset(amounts, 0, sizeof(amounts));
+    }
+    pthread_mutex_unlock(&statsLock);
+    
+    printf("Total Bank Assets: K " MONEY_FMT "\n", MONEY_ARGS(totalBalance));
+    printf("Total Active Accounts: %d\n", activeAccounts);
+    printf("Total Registered Accounts: %d\n", registered);
+    
+    printf("\nBalance Distribution:\n");
+    long long limit = MINIMUM_OPENING_DEPOSIT / 100;
+    for (int i = 0; i < BALANCE_BUCKETS; i++) {
+        char label[40];
+        if (i < BALANCE_BUCKETS - 1) {
+            snprintf(label, sizeof(label), "below K %lld", limit);
+        } else {
+            snprintf(label, sizeof(label), "K %lld and above", limit / 10);
+        }
+        printf("  %-20s %d\n", label, buckets[i]);
+        limit *= 10;
+    }
+    
+    printf("\nTop %d Accounts:\n", TOP_ACCOUNTS);
+    for (int i = 0; i < topCount; i++) {
+        int position = top[i].position;
+        printf("  %2d. %-20s %-10lld K " MONEY_FMT "\n", i + 1, accounts[position].fullName,
+               accountNumbers[position], MONEY_ARGS(top[i].balance));
+    }
+    pthread_rwlock_unlock(&accountsLock);
+    
+    const char *volumeNames[VOLUME_KINDS] = {"Deposits", "Withdrawals", "Transfers"};
+    printf("\nToday's Volume (since startup):\n");
+    for (int i = 0; i < VOLUME_KINDS; i++) {
+        printf("  %-12s %6lld  K " MONEY_FMT "\n", volumeNames[i], counts[i], MONEY_ARGS(amounts[i]));
+    }
+}
+
+// Locking functions
+void initializeLocks() {
+    // Prefer writers so a stream of operations cannot starve addAccount
+    pthread_rwlockattr_t attributes;
+    pthread_rwlockattr_init(&attributes);
+    pthread_rwlockattr_setkind_np(&attributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&accountsLock, &attributes);
+    pthread_rwlockattr_destroy(&attributes);
+    
+    for (int i = 0; i < ACCOUNT_LOCK_STRIPES; i++) {
+        pthread_mutex_init(&accountLocks[i], NULL);
+    }
+}
+
+void lockAccount(int position) {
+    pthread_mutex_lock(&accountLocks[position % ACCOUNT_LOCK_STRIPES]);
+}
+
+void unlockAccount(int position) {
+    pthread_mutex_unlock(&accountLocks[position % ACCOUNT_LOCK_STRIPES]);
+}
+
+// Locks two accounts in stripe order so two opposite transfers cannot
+// deadlock; accounts sharing a stripe take its lock once.
+void lockAccountPair(int first, int second) {
+    int a = first % ACCOUNT_LOCK_STRIPES;
+    int b = second % ACCOUNT_LOCK_STRIPES;
+    if (a == b) {
+        pthread_mutex_lock(&accountLocks[a]);
+    } else if (a < b) {
+        pthread_mutex_lock(&accountLocks[a]);
+        pthread_mutex_lock(&accountLocks[b]);
+    } else {
+        pthread_mutex_lock(&accountLocks[b]);
+        pthread_mutex_lock(&accountLocks[a]);
+    }
+}
+
+void unlockAccountPair(int first, int second) {
+    int a = first % ACCOUNT_LOCK_STRIPES;
+    int b = second % ACCOUNT_LOCK_STRIPES;
+    pthread_mutex_unlock(&accountLocks[a]);
+    if (a != b) {
+        pthread_mutex_unlock(&accountLocks[b]);
+    }
+}
+
+// Holds every account stripe, in ascending order, so no balance changes
+// while it is held.
+void lockAllAccounts() {
+    for (int i = 0; i < ACCOUNT_LOCK_STRIPES; i++) {
+        pthread_mutex_lock(&accountLocks[i]);
+    }
+}
+
+void unlockAllAccounts() {
+    for (int i = ACCOUNT_LOCK_STRIPES - 1; i >= 0; i--) {
+        pthread_mutex_unlock(&accountLocks[i]);
+    }
+}
+
+// Book snapshots
+// Copies one page of balances into the pending snapshot unless it has
+// been copied already. Whoever gets to a page first copies it: the
+// snapshot's own scan, or a writer about to change an account on it.
+void copySnapshotPage(int page) {
+    BookSnapshot *snapshot = pendingSnapshot;
+    int first = page * BOOK_SNAPSHOT_PAGE;
+    pthread_mutex_lock(&snapshotPageLock);
+    if (first < snapshot->count && !snapshotPagesCopied[page]) {
+        int length = snapshot->count - first;
+        if (length > BOOK_SNAPSHOT_PAGE) length = BOOK_SNAPSHOT_PAGE;
+        memcpy(snapshot->balances + first, accountBalances + first, length * sizeof(long long));
+        memcpy(snapshot->active + first, accountActive + first, length);
+        snapshotPagesCopied[page] = 1;
+    }
+    pthread_mutex_unlock(&snapshotPageLock);
+}
+
+// Called with the account's stripe held, before its balance or status
+// changes, so a snapshot being copied keeps the value it had.
+void preserveAccount(int position) {
+    if (pendingSnapshot != NULL) {
+        copySnapshotPage(position / BOOK_SNAPSHOT_PAGE);
+    }
+}
+
+// Returns a copy of every account as of one instant (free it with
+// freeBookSnapshot), or NULL if memory ran out. Every stripe is held only
+// while the snapshot is published, not for the copy: balances are copied
+// a page at a time, and a writer copies a page itself before changing it
+// (copy on write), so reports never see half a transfer and customers
+// never wait for the scan. Accounts registered meanwhile sit past the
+// snapshot's count, and the columns never move, so they need no care.
+BookSnapshot *takeBookSnapshot() {
+    pthread_mutex_lock(&snapshotTakeLock);
+    pthread_rwlock_rdlock(&accountsLock);
+    int count = accountCount;
+    int pages = count / BOOK_SNAPSHOT_PAGE + 1;
+    size_t slots = (count > 0) ? count : 1;
+    BookSnapshot *snapshot = calloc(1, sizeof(BookSnapshot));
+    unsigned char *copied = calloc(pages, 1);
+    if (snapshot != NULL) {
+        snapshot->count = count;
+        snapshot->numbers = malloc(slots * sizeof(long long));
+        snapshot->balances = malloc(slots * sizeof(long long));
+        snapshot->active = malloc(slots);
+        snapshot->names = malloc(slots * sizeof(char *));
+    }
+    if (snapshot == NULL || copied == NULL || snapshot->numbers == NULL || snapshot->balances == NULL ||
+        snapshot->active == NULL || snapshot->names == NULL) {
+        pthread_rwlock_unlock(&accountsLock);
+        pthread_mutex_unlock(&snapshotTakeLock);
+        freeBookSnapshot(snapshot);
+        free(copied);
+        return NULL;
+    }
+    
+    // Numbers and names never change once an account exists
+    memcpy(snapshot->numbers, accountNumbers, count * sizeof(long long));
+    for (int i = 0; i < count; i++) {
+        snapshot->names[i] = accounts[i].fullName;
+    }
+    
+    lockAllAccounts();
+    pthread_mutex_lock(&statsLock);
+    snapshot->statisticsTotal = statsTotalBalance;
+    pthread_mutex_unlock(&statsLock);
+    snapshotPagesCopied = copied;
+    pendingSnapshot = snapshot;
+    unlockAllAccounts();
+    pthread_rwlock_unlock(&accountsLock);
+    
+    for (int page = 0; page < pages; page++) {
+        copySnapshotPage(page);
+    }
+    
+    lockAllAccounts();
+    pendingSnapshot = NULL;
+    snapshotPagesCopied = NULL;
+    unlockAllAccounts();
+    pthread_mutex_unlock(&snapshotTakeLock);
+    free(copied);
+    return snapshot;
+}
+
+void freeBookSnapshot(BookSnapshot *snapshot) {
+    if (snapshot == NULL) return;
+    free(snapshot->numbers);
+    free(snapshot->balances);
+    free(snapshot->active);
+    free(snapshot->names);
+    free(snapshot);
+}
+
+// Bulk output
+// Collects formatted output in a large buffer and hands it to write(2) in
+// few big pieces, instead of one stdio call (and often one syscall) per
+// line. Works on any descriptor: terminal, file or pipe.
+typedef struct {
+    int fd;
+    char *buffer;
+    size_t used;
+    int failed;
+} BulkWriter;
+
+int openBulkWriter(BulkWriter *writer, int fd) {
+    writer->fd = fd;
+    writer->used = 0;
+    writer->failed = 0;
+    writer->buffer = malloc(BULK_WRITER_BUFFER_SIZE);
+    return writer->buffer != NULL;
+}
+
+void flushBulkWriter(BulkWriter *writer) {
+    size_t done = 0;
+    while (done < writer->used && !writer->failed) {
+        ssize_t written = write(writer->fd, writer->buffer + done, writer->used - done);
+        if (written < 0) {
+            writer->failed = 1;
+        } else {
+            done += written;
+        }
+    }
+    writer->used = 0;
+}
+
+__attribute__((format(printf, 2, 3)))
+void bulkPrintf(BulkWriter *writer, const char *format, ...) {
+    if (BULK_WRITER_BUFFER_SIZE - writer->used < BULK_WRITER_LINE_MAX) {
+        flushBulkWriter(writer);
+    }
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(writer->buffer + writer->used, BULK_WRITER_BUFFER_SIZE - writer->used, format, args);
+    va_end(args);
+    if (length > 0) {
+        writer->used += ((size_t)length < BULK_WRITER_BUFFER_SIZE - writer->used)
+                        ? (size_t)length : BULK_WRITER_BUFFER_SIZE - writer->used - 1;
+    }
+}
+
+// Flushes and frees the buffer. Returns 0 if any write failed.
+int closeBulkWriter(BulkWriter *writer) {
+    flushBulkWriter(writer);
+    free(writer->buffer);
+    writer->buffer = NULL;
+    return !writer->failed;
+}
+
+// Instrumentation
+// Each operation keeps a call count, total and maximum latency and a
+// histogram with power-of-two nanosecond buckets; each file keeps read,
+// write and fsync counts. Counters are updated with relaxed atomics and
+// live on their own cache lines, so probes cost a few nanoseconds.
+const char *metricNames[METRIC_OPERATIONS] = {
+    "account_lookup", "verify_password", "append_transaction", "commit",
+    "wal_append", "save_snapshot", "load_snapshot"
+};
+const char *ioFileNames[IO_FILES] = {"snapshot", "wal", "history", "index"};
+
+#ifndef BANK_NO_METRICS
+typedef struct {
+    unsigned long long calls;
+    unsigned long long timed;
+    unsigned long long totalNs;
+    unsigned long long maxNs;
+    unsigned long long buckets[METRIC_BUCKETS];
+} __attribute__((aligned(64))) LatencyMetric;
+
+typedef struct {
+    unsigned long long reads;
+    unsigned long long readBytes;
+    unsigned long long writes;
+    unsigned long long writeBytes;
+    unsigned long long syncs;
+} __attribute__((aligned(64))) IoMetric;
+
+LatencyMetric latencyMetrics[METRIC_OPERATIONS];
+IoMetric ioMetrics[IO_FILES];
+
+pthread_mutex_t metricsDumpLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t metricsDumpWake = PTHREAD_COND_INITIALIZER;
+pthread_t metricsDumper;
+int metricsDumperRunning = 0;
+int metricsDumperStop = 0;
+
+void endMetricScope(MetricScope *scope) {
+    if (scope->startNs == 0) return;
+    LatencyMetric *metric = &latencyMetrics[scope->id];
+    unsigned long long elapsed = currentTimeNs() - scope->startNs;
+    int bucket = 63 - __builtin_clzll(elapsed | 1);
+    if (bucket >= METRIC_BUCKETS) bucket = METRIC_BUCKETS - 1;
+    
+    __atomic_fetch_add(&metric->calls, scope->weight, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&metric->timed, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&metric->totalNs, elapsed, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&metric->buckets[bucket], 1, __ATOMIC_RELAXED);
+    unsigned long long max = __atomic_load_n(&metric->maxNs, __ATOMIC_RELAXED);
+    while (elapsed > max &&
+           !__atomic_compare_exchange_n(&metric->maxNs, &max, elapsed, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void recordIo(IoFile file, int write, long long bytes) {
+    IoMetric *metric = &ioMetrics[file];
+    if (write) {
+        __atomic_fetch_add(&metric->writes, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&metric->writeBytes, bytes, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_add(&metric->reads, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&metric->readBytes, bytes, __ATOMIC_RELAXED);
+    }
+}
+
+void recordSync(IoFile file) {
+    __atomic_fetch_add(&ioMetrics[file].syncs, 1, __ATOMIC_RELAXED);
+}
+
+// Copies the counters; concurrent probes may land on either side
+void readLatencyMetric(MetricId id, LatencyMetric *copy) {
+    const LatencyMetric *metric = &latencyMetrics[id];
+    copy->calls = __atomic_load_n(&metric->calls, __ATOMIC_RELAXED);
+    copy->timed = __atomic_load_n(&metric->timed, __ATOMIC_RELAXED);
+    copy->totalNs = __atomic_load_n(&metric->totalNs, __ATOMIC_RELAXED);
+    copy->maxNs = __atomic_load_n(&metric->maxNs, __ATOMIC_RELAXED);
+    for (int i = 0; i < METRIC_BUCKETS; i++) {
+        copy->buckets[i] = __atomic_load_n(&metric->buckets[i], __ATOMIC_RELAXED);
+    }
+}
+
+void readIoMetric(IoFile file, IoMetric *copy) {
+    const IoMetric *metric = &ioMetrics[file];
+    copy->reads = __atomic_load_n(&metric->reads, __ATOMIC_RELAXED);
+    copy->readBytes = __atomic_load_n(&metric->readBytes, __ATOMIC_RELAXED);
+    copy->writes = __atomic_load_n(&metric->writes, __ATOMIC_RELAXED);
+    copy->writeBytes = __atomic_load_n(&metric->writeBytes, __ATOMIC_RELAXED);
+    copy->syncs = __atomic_load_n(&metric->syncs, __ATOMIC_RELAXED);
+}
+
+// Upper bound of the bucket holding the given fraction of timed calls,
+// capped at the largest latency seen
+unsigned long long metricPercentileNs(const LatencyMetric *metric, double fraction) {
+    unsigned long long wanted = (unsigned long long)(metric->timed * fraction);
+    unsigned long long seen = 0;
+    for (int i = 0; i < METRIC_BUCKETS; i++) {
+        seen += metric->buckets[i];
+        if (seen > wanted) {
+            return ((2ULL << i) < metric->maxNs) ? 2ULL << i : metric->maxNs;
+        }
+    }
+    return metric->maxNs;
+}
+
+void displayMetrics() {
+    printf("%-20s %12s %10s %10s %10s %10s\n", "Operation", "Calls", "avg us", "p50 us", "p99 us", "max us");
+    for (int i = 0; i < METRIC_OPERATIONS; i++) {
+        LatencyMetric metric;
+        readLatencyMetric((MetricId)i, &metric);
+        double average = (metric.timed > 0) ? (double)metric.totalNs / metric.timed / 1000.0 : 0.0;
+        printf("%-20s %12llu %10.1f %10.1f %10.1f %10.1f\n", metricNames[i], metric.calls, average,
+               metric.timed ? metricPercentileNs(&metric, 0.50) / 1000.0 : 0.0,
+               metric.timed ? metricPercentileNs(&metric, 0.99) / 1000.0 : 0.0,
+               metric.maxNs / 1000.0);
+    }
+    printf("\nPercentiles are bucket upper bounds; account_lookup is sampled 1 in %d.\n\n",
+           METRIC_LOOKUP_SAMPLE_MASK + 1);
+    
+    printf("%-10s %10s %14s %10s %14s %8s\n", "File", "Reads", "Read bytes", "Writes", "Write bytes", "fsyncs");
+    for (int i = 0; i < IO_FILES; i++) {
+        IoMetric metric;
+        readIoMetric((IoFile)i, &metric);
+        printf("%-10s %10llu %14llu %10llu %14llu %8llu\n", ioFileNames[i], metric.reads, metric.readBytes,
+               metric.writes, metric.writeBytes, metric.syncs);
+    }
+}
+
+// Writes every counter to METRICS_FILE in the Prometheus text format,
+// replacing the previous dump atomically.
+int writeMetricsFile() {
+    int fd = open(METRICS_FILE ".tmp", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    BulkWriter writer;
+    if (fd == -1 || !openBulkWriter(&writer, fd)) {
+        if (fd != -1) close(fd);
+        return 0;
+    }
+    
+    bulkPrintf(&writer, "# TYPE bank_operation_latency_ns histogram\n");
+    for (int i = 0; i < METRIC_OPERATIONS; i++) {
+        LatencyMetric metric;
+        readLatencyMetric((MetricId)i, &metric);
+        unsigned long long cumulative = 0;
+        for (int b = 0; b < METRIC_BUCKETS; b++) {
+            cumulative += metric.buckets[b];
+            if (metric.buckets[b] == 0 && cumulative == 0) continue;
+            bulkPrintf(&writer, "bank_operation_latency_ns_bucket{op=\"%s\",le=\"%llu\"} %llu\n",
+                       metricNames[i], 2ULL << b, cumulative);
+        }
+        bulkPrintf(&writer, "bank_operation_latency_ns_bucket{op=\"%s\",le=\"+Inf\"} %llu\n", metricNames[i], metric.timed);
+        bulkPrintf(&writer, "bank_operation_latency_ns_sum{op=\"%s\"} %llu\n", metricNames[i], metric.totalNs);
+        bulkPrintf(&writer, "bank_operation_latency_ns_count{op=\"%s\"} %llu\n", metricNames[i], metric.timed);
+        bulkPrintf(&writer, "bank_operation_calls_total{op=\"%s\"} %llu\n", metricNames[i], metric.calls);
+        bulkPrintf(&writer, "bank_operation_latency_ns_max{op=\"%s\"} %llu\n", metricNames[i], metric.maxNs);
+    }
+    for (int i = 0; i < IO_FILES; i++) {
+        IoMetric metric;
+        readIoMetric((IoFile)i, &metric);
+        bulkPrintf(&writer, "bank_file_reads_total{file=\"%s\"} %llu\n", ioFileNames[i], metric.reads);
+        bulkPrintf(&writer, "bank_file_read_bytes_total{file=\"%s\"} %llu\n", ioFileNames[i], metric.readBytes);
+        bulkPrintf(&writer, "bank_file_writes_total{file=\"%s\"} %llu\n", ioFileNames[i], metric.writes);
+        bulkPrintf(&writer, "bank_file_write_bytes_total{file=\"%s\"} %llu\n", ioFileNames[i], metric.writeBytes);
+        bulkPrintf(&writer, "bank_file_fsyncs_total{file=\"%s\"} %llu\n", ioFileNames[i], metric.syncs);
+    }
+    
+    int ok = closeBulkWriter(&writer);
+    ok = (close(fd) == 0) && ok;
+    return ok && rename(METRICS_FILE ".tmp", METRICS_FILE) == 0;
+}
+
+void *metricsDumperMain(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&metricsDumpLock);
+    while (!metricsDumperStop) {
+        struct timespec wake;
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_sec += metricsDumpInterval;
+        pthread_cond_timedwait(&metricsDumpWake, &metricsDumpLock, &wake);
+        if (!metricsDumperStop) {
+            pthread_mutex_unlock(&metricsDumpLock);
+            writeMetricsFile();
+            pthread_mutex_lock(&metricsDumpLock);
+        }
+    }
+    pthread_mutex_unlock(&metricsDumpLock);
+    return NULL;
+}
+
+// Starts the thread that rewrites METRICS_FILE every metricsDumpInterval
+// seconds (0 disables it)
+void startMetricsDumper() {
+    if (metricsDumpInterval <= 0 || metricsDumperRunning) return;
+    metricsDumperStop = 0;
+    metricsDumperRunning = (pthread_create(&metricsDumper, NULL, metricsDumperMain, NULL) == 0);
+}
+
+// Stops the dumper and writes one last dump
+void stopMetricsDumper() {
+    if (!metricsDumperRunning) return;
+    pthread_mutex_lock(&metricsDumpLock);
+    metricsDumperStop = 1;
+    pthread_cond_signal(&metricsDumpWake);
+    pthread_mutex_unlock(&metricsDumpLock);
+    pthread_join(metricsDumper, NULL);
+    metricsDumperRunning = 0;
+    writeMetricsFile();
+}
+#else
+void displayMetrics() {
+    printf("Instrumentation was compiled out of this build (BANK_NO_METRICS).\n");
+}
+
+void startMetricsDumper() {
+}
+
+void stopMetricsDumper() {
+}
+#endif
+
+// Account listing
+// A listing is a copy of the active accounts sorted by one key, with the
+// account number breaking ties, so every row has one place in the order.
+// A cursor is the last row shown; the next page starts at the first row
+// after it. Pages therefore stay consistent when the listing is rebuilt
+// between requests and accounts have been added or balances moved.
+typedef enum {
+    SORT_BY_BALANCE,
+    SORT_BY_NUMBER,
+    SORT_BY_NAME,
+    SORT_KEYS
+} ListingSortKey;
+
+typedef struct {
+    long long balance;
+    long long accountNumber;
+    const char *name;
+} ListingEntry;
+
+const char *sortKeyNames[SORT_KEYS] = {"balance", "number", "name"};
+
+// Balance runs richest first; number and name run ascending
+int compareByBalance(const void *a, const void *b) {
+    const ListingEntry *x = a;
+    const ListingEntry *y = b;
+    if (x->balance != y->balance) return (x->balance < y->balance) ? 1 : -1;
+    return (x->accountNumber > y->accountNumber) - (x->accountNumber < y->accountNumber);
+}
+
+int compareByNumber(const void *a, const void *b) {
+    const ListingEntry *x = a;
+    const ListingEntry *y = b;
+    return (x->accountNumber > y->accountNumber) - (x->accountNumber < y->accountNumber);
+}
+
+// Same order as the name index, so "list name" and "find" agree
+int compareByName(const void *a, const void *b) {
+    const ListingEntry *x = a;
+    const ListingEntry *y = b;
+    int order = (x->name == y->name) ? 0 : strcasecmp(x->name, y->name);
+    if (order != 0) return order;
+    return (x->accountNumber > y->accountNumber) - (x->accountNumber < y->accountNumber);
+}
+
+int (*listingComparators[SORT_KEYS])(const void *, const void *) = {
+    compareByBalance, compareByNumber, compareByName
+};
+
+int parseSortKey(const char *text, ListingSortKey *key) {
+    for (int i = 0; i < SORT_KEYS; i++) {
+        if (strcmp(text, sortKeyNames[i]) == 0) {
+            *key = (ListingSortKey)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    ListingEntry *entries;
+    size_t count;
+    int (*compare)(const void *, const void *);
+} SortChunk;
+
+void *sortChunkMain(void *arg) {
+    SortChunk *chunk = arg;
+    qsort(chunk->entries, chunk->count, sizeof(ListingEntry), chunk->compare);
+    return NULL;
+}
+
+// Sorts large listings in parallel: each thread sorts one chunk, then
+// the sorted runs are merged pairwise until one is left.
+void sortListing(ListingEntry *entries, size_t count, ListingSortKey key) {
+    int (*compare)(const void *, const void *) = listingComparators[key];
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threadCount = (cpus > LISTING_MAX_SORT_THREADS) ? LISTING_MAX_SORT_THREADS : (int)cpus;
+    ListingEntry *scratch = (count >= LISTING_PARALLEL_THRESHOLD && threadCount > 1)
+                            ? malloc(count * sizeof(ListingEntry)) : NULL;
+    if (scratch == NULL) {
+        qsort(entries, count, sizeof(ListingEntry), compare);
+        return;
+    }
+    
+    SortChunk chunks[LISTING_MAX_SORT_THREADS];
+    pthread_t threads[LISTING_MAX_SORT_THREADS];
+    size_t runStarts[LISTING_MAX_SORT_THREADS + 1];
+    for (int i = 0; i <= threadCount; i++) {
+        runStarts[i] = count * i / threadCount;
+    }
+    int started = 0;
+    for (int i = 0; i < threadCount; i++) {
+        chunks[i].entries = entries + runStarts[i];
+        chunks[i].count = runStarts[i + 1] - runStarts[i];
+        chunks[i].compare = compare;
+        if (i == threadCount - 1 || pthread_create(&threads[i], NULL, sortChunkMain, &chunks[i]) != 0) {
+            sortChunkMain(&chunks[i]);
+        } else {
+            started |= 1 << i;
+        }
+    }
+    for (int i = 0; i < threadCount; i++) {
+        if (started & (1 << i)) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    
+    ListingEntry *source = entries;
+    ListingEntry *target = scratch;
+    for (int runs = threadCount, width = 1; runs > 1; runs = (runs + 1) / 2, width *= 2) {
+        for (int run = 0; run < threadCount; run += 2 * width) {
+            size_t left = runStarts[run];
+            size_t middle = runStarts[(run + width < threadCount) ? run + width : threadCount];
+            size_t end = runStarts[(run + 2 * width < threadCount) ? run + 2 * width : threadCount];
+            size_t i = left, j = middle, out = left;
+            while (i < middle && j < end) {
+                target[out++] = (compare(&source[j], &source[i]) < 0) ? source[j++] : source[i++];
+            }
+            while (i < middle) target[out++] = source[i++];
+            while (j < end) target[out++] = source[j++];
+        }
+        ListingEntry *swap = source;
+        source = target;
+        target = swap;
+    }
+    if (source != entries) {
+        memcpy(entries, source, count * sizeof(ListingEntry));
+    }
+    free(scratch);
+}
+
+// Returns the active accounts sorted by key in a new array (free it), or
+// NULL if memory ran out. It is built from a book snapshot, so it is one
+// consistent state of the book.
+ListingEntry *buildAccountListing(ListingSortKey key, int *count) {
+    *count = 0;
+    BookSnapshot *snapshot = takeBookSnapshot();
+    if (snapshot == NULL) return NULL;
+    ListingEntry *entries = malloc((snapshot->count > 0 ? snapshot->count : 1) * sizeof(ListingEntry));
+    int found = 0;
+    if (entries != NULL) {
+        for (int i = 0; i < snapshot->count; i++) {
+            if (snapshot->active[i]) {
+                entries[found].balance = snapshot->balances[i];
+                entries[found].accountNumber = snapshot->numbers[i];
+                entries[found].name = snapshot->names[i];
+                found++;
+            }
+        }
+        sortListing(entries, found, key);
+    }
+    freeBookSnapshot(snapshot);
+    *count = found;
+    return entries;
+}
+
+// Index of the first entry after cursor (binary search), or 0 without one
+int seekListing(const ListingEntry *entries, int count, ListingSortKey key, const ListingEntry *cursor) {
+    if (cursor == NULL) return 0;
+    int low = 0;
+    int high = count;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (listingComparators[key](&entries[middle], cursor) <= 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+void writeListingTable(BulkWriter *writer, const ListingEntry *entries, int from, int to) {
+    bulkPrintf(writer, "%-20s %-15s %-15s\n", "Account Holder", "Account Number", "Balance (K)");
+    bulkPrintf(writer, "-------------------------------------------------\n");
+    for (int i = from; i < to; i++) {
+        bulkPrintf(writer, "%-20s %-15lld " MONEY_FMT "\n",
+                   entries[i].name, entries[i].accountNumber, MONEY_ARGS(entries[i].balance));
+    }
+}
+
+// Writes text into out as a double-quoted CSV field, doubling any quotes
+// inside it. size of twice the text plus three always suffices.
+void quoteCsvField(const char *text, char *out, size_t size) {
+    size_t used = 0;
+    out[used++] = '"';
+    for (; *text != '\0' && used + 3 < size; text++) {
+        if (*text == '"') out[used++] = '"';
+        out[used++] = *text;
+    }
+    out[used++] = '"';
+    out[used] = '\0';
+}
+
+void writeListingCsv(BulkWriter *writer, const ListingEntry *entries, int count) {
+    bulkPrintf(writer, "account_number,name,balance\n");
+    char quotedName[2 * MAX_NAME_LENGTH + 3];
+    for (int i = 0; i < count; i++) {
+        quoteCsvField(entries[i].name, quotedName, sizeof(quotedName));
+        bulkPrintf(writer, "%lld,%s," MONEY_FMT "\n",
+                   entries[i].accountNumber, quotedName, MONEY_ARGS(entries[i].balance));
+    }
+}
+
+// Streams the whole listing as CSV to fd. Returns the number of rows, or
+// -1 on failure.
+int exportAccountListing(ListingSortKey key, int fd) {
+    int count;
+    ListingEntry *entries = buildAccountListing(key, &count);
+    BulkWriter writer;
+    if (entries == NULL || !openBulkWriter(&writer, fd)) {
+        free(entries);
+        return -1;
+    }
+    writeListingCsv(&writer, entries, count);
+    free(entries);
+    return closeBulkWriter(&writer) ? count : -1;
+}
+
+// Admin view: pages through a listing sorted by the chosen key
+void browseAccountListing() {
+    int keyChoice;
+    printf("Sort by: 1. Balance  2. Account Number  3. Name\n");
+    printf("Enter your choice: ");
+    scanf("%d", &keyChoice);
+    clearInputBuffer();
+    if (keyChoice < 1 || keyChoice > SORT_KEYS) {
+        printf("Invalid choice!\n");
+        pauseScreen();
+        return;
+    }
+    ListingSortKey key = (ListingSortKey)(keyChoice - 1);
+    
+    int count;
+    ListingEntry *entries = buildAccountListing(key, &count);
+    BulkWriter writer;
+    if (entries == NULL || !openBulkWriter(&writer, STDOUT_FILENO)) {
+        printf("Error: Memory allocation failed.\n");
+        free(entries);
+        pauseScreen();
+        return;
+    }
+    
+    int start = 0;
+    char command[PATH_MAX];
+    for (;;) {
+        int end = (start + LISTING_PAGE_SIZE < count) ? start + LISTING_PAGE_SIZE : count;
+        clearScreen();
+        fflush(stdout);
+        bulkPrintf(&writer, "=== ALL ACCOUNTS (%d active, by %s) ===\n\n", count, sortKeyNames[key]);
+        writeListingTable(&writer, entries, start, end);
+        bulkPrintf(&writer, "\nRows %d-%d of %d\n", (count > 0) ? start + 1 : 0, end, count);
+        bulkPrintf(&writer, "[n] next  [p] previous  [e] export to file  [q] back: ");
+        flushBulkWriter(&writer);
+        
+        if (fgets(command, sizeof(command), stdin) == NULL || command[0] == 'q') {
+            break;
+        } else if (command[0] == 'n' && end < count) {
+            start = end;
+        } else if (command[0] == 'p') {
+            start = (start > LISTING_PAGE_SIZE) ? start - LISTING_PAGE_SIZE : 0;
+        } else if (command[0] == 'e') {
+            printf("Export file: ");
+            if (fgets(command, sizeof(command), stdin) == NULL) break;
+            command[strcspn(command, "\n")] = 0;
+            int fd = open(command, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            BulkWriter fileWriter;
+            if (fd == -1 || !openBulkWriter(&fileWriter, fd)) {
+                printf("Error: Could not open %s.\n", command);
+            } else {
+                writeListingCsv(&fileWriter, entries, count);
+                if (closeBulkWriter(&fileWriter)) {
+                    printf("Exported %d accounts to %s.\n", count, command);
+                } else {
+                    printf("Error: Could not write %s.\n", command);
+                }
+            }
+            if (fd != -1) close(fd);
+            pauseScreen();
+        }
+    }
+    closeBulkWriter(&writer);
+    free(entries);
+}
+
+// Name search
+// Matches run in name index order, so a page ends at a row and the next
+// page starts after that row's account, like the listing cursor. Prefix
+// searches binary-search the index and stop at the first name that no
+// longer matches. Substring searches first scan the folded name pool;
+// when few names match, each one's run in the index is found by binary
+// search, otherwise matches are dense enough to walk the index until the
+// page is full, testing each distinct name once.
+typedef enum {
+    NAME_MATCH_PREFIX,
+    NAME_MATCH_SUBSTRING
+} NameMatch;
+
+typedef struct {
+    long long accountNumber;
+    long long balance;
+    const char *name;
+    int isActive;
+} NameSearchRow;
+
+int compareNames(const void *a, const void *b) {
+    return strcasecmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+// Copies the account at position into the next row. Returns 0, and sets
+// *more, if the rows are already full.
+int addNameSearchRow(int position, NameSearchRow *rows, int limit, int *found, int *more) {
+    if (*found == limit) {
+        *more = 1;
+        return 0;
+    }
+    NameSearchRow *row = &rows[(*found)++];
+    lockAccount(position);
+    row->accountNumber = accountNumbers[position];
+    row->balance = accountBalances[position];
+    row->name = accounts[position].fullName;
+    row->isActive = accountActive[position];
+    unlockAccount(position);
+    return 1;
+}
+
+// Fills rows with up to limit accounts whose holder name matches text,
+// ignoring case, starting after account number after (-1 for the first
+// page). Sets *more if further matches follow. Returns the number of
+// rows, or -1 if after is not an account.
+int searchAccountsByName(const char *text, NameMatch match, long long after,
+                         NameSearchRow *rows, int limit, int *more) {
+    size_t length = strlen(text);
+    *more = 0;
+    pthread_rwlock_rdlock(&accountsLock);
+    int start = (match == NAME_MATCH_PREFIX) ? seekNamePrefix(text, length) : 0;
+    if (after != -1) {
+        int position = findAccountIndex(after);
+        if (position == -1) {
+            pthread_rwlock_unlock(&accountsLock);
+            return -1;
+        }
+        int next = seekNameIndex(accounts[position].fullName, after) + 1;
+        if (next > start) start = next;
+    }
+    
+    int found = 0;
+    int matchedNames = -1;
+    const char *names[NAME_SEARCH_SEEK_LIMIT];
+    if (match == NAME_MATCH_SUBSTRING && length < MAX_NAME_LENGTH) {
+        char needle[MAX_NAME_LENGTH];
+        for (size_t i = 0; i <= length; i++) {
+            needle[i] = (char)tolower((unsigned char)text[i]);
+        }
+        matchedNames = findPooledNames(needle, length, names, NAME_SEARCH_SEEK_LIMIT);
+    }
+    
+    if (matchedNames >= 0 && matchedNames <= NAME_SEARCH_SEEK_LIMIT) {
+        // Names that differ only in case share one run of the index
+        qsort(names, matchedNames, sizeof(const char *), compareNames);
+        for (int i = 0; i < matchedNames && !*more; i++) {
+            if (i > 0 && strcasecmp(names[i], names[i - 1]) == 0) continue;
+            int slot = seekNameIndex(names[i], LLONG_MIN);
+            if (slot < start) slot = start;
+            for (; slot < nameIndexCount && strcasecmp(accounts[nameIndex[slot]].fullName, names[i]) == 0; slot++) {
+                if (!addNameSearchRow(nameIndex[slot], rows, limit, &found, more)) break;
+            }
+        }
+    } else {
+        const char *lastName = NULL;
+        int lastMatched = 0;
+        for (int i = start; i < nameIndexCount; i++) {
+            int position = nameIndex[i];
+            const char *name = accounts[position].fullName;
+            if (name != lastName) {
+                lastName = name;
+                lastMatched = (match == NAME_MATCH_PREFIX)
+                              ? strncasecmp(name, text, length) == 0
+                              : strcasestr(name, text) != NULL;
+                if (!lastMatched && match == NAME_MATCH_PREFIX) break;
+            }
+            if (lastMatched && !addNameSearchRow(position, rows, limit, &found, more)) break;
+        }
+    }
+    pthread_rwlock_unlock(&accountsLock);
+    return found;
+}
+
+// Admin view: pages through the accounts whose name matches a search
+void searchAccountsView() {
+    int matchChoice;
+    char text[MAX_NAME_LENGTH];
+    printf("Match: 1. Name starts with  2. Name contains\n");
+    printf("Enter your choice: ");
+    scanf("%d", &matchChoice);
+    clearInputBuffer();
+    if (matchChoice < 1 || matchChoice > 2) {
+        printf("Invalid choice!\n");
+        pauseScreen();
+        return;
+    }
+    printf("Search for: ");
+    if (fgets(text, sizeof(text), stdin) == NULL) return;
+    text[strcspn(text, "\n")] = 0;
+    NameMatch match = (matchChoice == 1) ? NAME_MATCH_PREFIX : NAME_MATCH_SUBSTRING;
+    
+    // The account each page started after, so [p] can go back
+    long long *pageStarts = NULL;
+    int page = 0;
+    long long after = -1;
+    NameSearchRow rows[LISTING_PAGE_SIZE];
+    char command[16];
+    for (;;) {
+        int more;
+        long long startNs = currentTimeNs();
+        int count = searchAccountsByName(text, match, after, rows, LISTING_PAGE_SIZE, &more);
+        long long elapsedUs = (currentTimeNs() - startNs) / 1000;
+        clearScreen();
+        printf("=== ACCOUNTS MATCHING \"%s\" ===\n\n", text);
+        printf("%-20s %-15s %-9s %-15s\n", "Account Holder", "Account Number", "Status", "Balance (K)");
+        printf("-----------------------------------------------------------\n");
+        for (int i = 0; i < count; i++) {
+            printf("%-20s %-15lld %-9s " MONEY_FMT "\n", rows[i].name, rows[i].accountNumber,
+                   rows[i].isActive ? "Active" : "Inactive", MONEY_ARGS(rows[i].balance));
+        }
+        printf("\nPage %d, %d rows (%lld us)%s\n", page + 1, (count > 0) ? count : 0, elapsedUs,
+               more ? "" : ", no more matches");
+        printf("[n] next  [p] previous  [q] back: ");
+        
+        if (fgets(command, sizeof(command), stdin) == NULL || command[0] == 'q') {
+            break;
+        } else if (command[0] == 'n' && more) {
+            long long *grown = realloc(pageStarts, (page + 1) * sizeof(long long));
+            if (grown == NULL) continue;
+            pageStarts = grown;
+            pageStarts[page++] = after;
+            after = rows[count - 1].accountNumber;
+        } else if (command[0] == 'p' && page > 0) {
+            after = pageStarts[--page];
+        }
+    }
+    free(pageStarts);
+}
+
+// Checksum functions
+// CRC32C (Castagnoli), the checksum of the snapshot's header and data
+// blocks. SSE4.2 computes it in hardware; elsewhere a slicing-by-8 table
+// handles eight bytes per step.
+#define CRC32C_POLYNOMIAL 0x82F63B78U
+
+uint32_t crc32cTable[8][256];
+pthread_once_t crc32cTableOnce = PTHREAD_ONCE_INIT;
+
+void buildCrc32cTable() {
+    for (int i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (CRC32C_POLYNOMIAL & -(crc & 1));
+        }
+        crc32cTable[0][i] = crc;
+    }
+    for (int i = 0; i < 256; i++) {
+        for (int slice = 1; slice < 8; slice++) {
+            uint32_t previous = crc32cTable[slice - 1][i];
+            crc32cTable[slice][i] = (previous >> 8) ^ crc32cTable[0][previous & 0xFF];
+        }
+    }
+}
+
+uint32_t crc32cUpdateSoftware(uint32_t crc, const unsigned char *data, size_t length) {
+    pthread_once(&crc32cTableOnce, buildCrc32cTable);
+    while (length >= 8) {
+        uint32_t low;
+        uint32_t high;
+        memcpy(&low, data, 4);
+        memcpy(&high, data + 4, 4);
+        low ^= crc;
+        crc = crc32cTable[7][low & 0xFF] ^ crc32cTable[6][(low >> 8) & 0xFF] ^
+              crc32cTable[5][(low >> 16) & 0xFF] ^ crc32cTable[4][low >> 24] ^
+              crc32cTable[3][high & 0xFF] ^ crc32cTable[2][(high >> 8) & 0xFF] ^
+              crc32cTable[1][(high >> 16) & 0xFF] ^ crc32cTable[0][high >> 24];
+        data += 8;
+        length -= 8;
+    }
+    while (length-- > 0) {
+        crc = (crc >> 8) ^ crc32cTable[0][(crc ^ *data++) & 0xFF];
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+uint32_t crc32cUpdateHardware(uint32_t crc, const unsigned char *data, size_t length) {
+    uint64_t state = crc;
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        state = _mm_crc32_u64(state, word);
+        data += 8;
+        length -= 8;
+    }
+    while (length-- > 0) {
+        state = _mm_crc32_u8((uint32_t)state, *data++);
+    }
+    return (uint32_t)state;
+}
+
+// The crc32 instruction takes three cycles but can start every cycle, so
+// three blocks are checksummed side by side to keep it busy.
+__attribute__((target("sse4.2")))
+void crc32cBlocksHardware(const unsigned char *data, size_t size, size_t blockSize, uint32_t *crcs) {
+    size_t blocks = (size + blockSize - 1) / blockSize;
+    size_t block = 0;
+    size_t words = blockSize / 8;
+    
+    for (; (block + 3) * blockSize <= size; block += 3) {
+        const unsigned char *first = data + block * blockSize;
+        const unsigned char *second = first + blockSize;
+        const unsigned char *third = second + blockSize;
+        uint64_t crc0 = 0xFFFFFFFFU;
+        uint64_t crc1 = 0xFFFFFFFFU;
+        uint64_t crc2 = 0xFFFFFFFFU;
+        for (size_t i = 0; i < words; i++) {
+            uint64_t word0;
+            uint64_t word1;
+            uint64_t word2;
+            memcpy(&word0, first + i * 8, 8);
+            memcpy(&word1, second + i * 8, 8);
+            memcpy(&word2, third + i * 8, 8);
+            crc0 = _mm_crc32_u64(crc0, word0);
+            crc1 = _mm_crc32_u64(crc1, word1);
+            crc2 = _mm_crc32_u64(crc2, word2);
+        }
+        size_t done = words * 8;
+        crcs[block] = ~crc32cUpdateHardware((uint32_t)crc0, first + done, blockSize - done);
+        crcs[block + 1] = ~crc32cUpdateHardware((uint32_t)crc1, second + done, blockSize - done);
+        crcs[block + 2] = ~crc32cUpdateHardware((uint32_t)crc2, third + done, blockSize - done);
+    }
+    for (; block < blocks; block++) {
+        size_t start = block * blockSize;
+        size_t length = (size - start < blockSize) ? size - start : blockSize;
+        crcs[block] = ~crc32cUpdateHardware(0xFFFFFFFFU, data + start, length);
+    }
+}
+#endif
+
+uint32_t crc32c(const void *data, size_t length) {
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) {
+        return ~crc32cUpdateHardware(0xFFFFFFFFU, data, length);
+    }
+#endif
+    return ~crc32cUpdateSoftware(0xFFFFFFFFU, data, length);
+}
+
+// Checksums data in blockSize pieces (the last may be shorter), one CRC
+// per block into crcs.
+void crc32cBlocks(const void *data, size_t size, size_t blockSize, uint32_t *crcs) {
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc32cBlocksHardware(data, size, blockSize, crcs);
+        return;
+    }
+#endif
+    for (size_t start = 0, block = 0; start < size; start += blockSize, block++) {
+        size_t length = (size - start < blockSize) ? size - start : blockSize;
+        crcs[block] = crc32c((const unsigned char *)data + start, length);
+    }
+}
+
+// File handling functions
+// Writes the accounts at positions as a snapshot next to the old one and
+// renames it into place, so a crash mid-write never leaves a half-written
+// snapshot behind. Records are gathered into SNAPSHOT_BLOCK_SIZE blocks
+// and checksummed as each block is written; the header goes in last, once
+// the checksum table is known. Adds the bytes written to *bytes; the
+// caller makes the rename durable.
+int writeSnapshot(const char *path, const int *positions, int count, long long *bytes) {
+    char tmpPath[PATH_MAX];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    size_t dataSize = (size_t)count * sizeof(AccountRecord);
+    int blockCount = (int)((dataSize + SNAPSHOT_BLOCK_SIZE - 1) / SNAPSHOT_BLOCK_SIZE);
+    uint32_t *blockCrcs = malloc((blockCount + 1) * sizeof(uint32_t));
+    unsigned char *block = malloc(SNAPSHOT_BLOCK_SIZE);
+    FILE *file = (blockCrcs != NULL && block != NULL) ? fopen(tmpPath, "wb") : NULL;
+    if (file == NULL) {
+        printf("Error: Could not save data to %s.\n", path);
+        free(blockCrcs);
+        free(block);
+        return 0;
+    }
+    
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(SnapshotHeader));
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_FORMAT_VERSION;
+    header.recordSize = sizeof(AccountRecord);
+    header.recordCount = count;
+    header.blockSize = SNAPSHOT_BLOCK_SIZE;
+    header.blockCount = blockCount;
+    // A short write must fail the save, or the rename would publish a
+    // shard whose checksums cover data that never reached the file
+    int ok = (fwrite(&header, sizeof(SnapshotHeader), 1, file) == 1);
+    
+    AccountRecord record;
+    memset(&record, 0, sizeof(AccountRecord));
+    size_t used = 0;
+    int blocksDone = 0;
+    for (int i = 0; ok && i < count; i++) {
+        loadAccountRecord(positions[i], &record);
+        const unsigned char *bytes = (const unsigned char *)&record;
+        size_t remaining = sizeof(AccountRecord);
+        while (remaining > 0) {
+            size_t take = SNAPSHOT_BLOCK_SIZE - used;
+            if (take > remaining) take = remaining;
+            memcpy(block + used, bytes, take);
+            used += take;
+            bytes += take;
+            remaining -= take;
+            if (used == SNAPSHOT_BLOCK_SIZE) {
+                blockCrcs[blocksDone++] = crc32c(block, used);
+                ok = ok && fwrite(block, 1, used, file) == used;
+                METRIC_IO(IO_SNAPSHOT, 1, used);
+                used = 0;
+            }
+        }
+    }
+    if (ok && used > 0) {
+        blockCrcs[blocksDone++] = crc32c(block, used);
+        ok = fwrite(block, 1, used, file) == used;
+        METRIC_IO(IO_SNAPSHOT, 1, used);
+    }
+    ok = ok && fwrite(blockCrcs, sizeof(uint32_t), blockCount, file) == (size_t)blockCount;
+    METRIC_IO(IO_SNAPSHOT, 1, blockCount * sizeof(uint32_t));
+    
+    header.tableCrc = crc32c(blockCrcs, blockCount * sizeof(uint32_t));
+    header.headerCrc = crc32c(&header, offsetof(SnapshotHeader, headerCrc));
+    free(blockCrcs);
+    free(block);
+    
+    *bytes += sizeof(SnapshotHeader) + dataSize + (long long)blockCount * sizeof(uint32_t);
+    METRIC_IO(IO_SNAPSHOT, 1, sizeof(SnapshotHeader));
+    METRIC_SYNC(IO_SNAPSHOT);
+    if (!ok || fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(SnapshotHeader), 1, file) != 1 ||
+        fflush(file) != 0 || fsync(fileno(file)) != 0) {
+        printf("Error: Could not save data to %s.\n", path);
+        fclose(file);
+        unlink(tmpPath);
+        return 0;
+    }
+    fclose(file);
+    
+    if (rename(tmpPath, path) != 0) {
+        printf("Error: Could not save data to %s.\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+typedef struct {
+    int shard;
+    int saved;
+    long long bytes;
+} ShardSave;
+
+void *saveShardMain(void *arg) {
+    ShardSave *save = arg;
+    char path[64];
+    snprintf(path, sizeof(path), SNAPSHOT_SHARD_FILE, save->shard);
+    AccountShard *shard = &accountShards[save->shard];
+    save->saved = writeSnapshot(path, shard->positions, shard->count, &save->bytes);
+    return NULL;
+}
+
+// Writes every dirty shard, one thread per shard, then makes the renames
+// durable with one directory fsync. The first save after loading an
+// unsharded snapshot writes every shard and then removes the old file.
+// Returns 0 if any shard could not be written; it stays dirty.
+int saveDataToFile() {
+    METRIC_SCOPE(METRIC_SAVE_SNAPSHOT, 0);
+    ShardSave saves[ACCOUNT_SHARDS];
+    pthread_t threads[ACCOUNT_SHARDS];
+    int started[ACCOUNT_SHARDS];
+    int written = 0;
+    for (int i = 0; i < ACCOUNT_SHARDS; i++) {
+        saves[i].shard = i;
+        saves[i].saved = 0;
+        saves[i].bytes = 0;
+        started[i] = 0;
+        if (!accountShards[i].dirty) continue;
+        written++;
+        if (pthread_create(&threads[i], NULL, saveShardMain, &saves[i]) == 0) {
+            started[i] = 1;
+        } else {
+            saveShardMain(&saves[i]);
+        }
+    }
+    
+    int ok = 1;
+    for (int i = 0; i < ACCOUNT_SHARDS; i++) {
+        if (!accountShards[i].dirty) continue;
+        if (started[i]) pthread_join(threads[i], NULL);
+        bytesWritten += saves[i].bytes;
+        fsyncCount++;
+        if (saves[i].saved) {
+            accountShards[i].dirty = 0;
+        } else {
+            ok = 0;
+        }
+    }
+    if (written == 0) return 1;
+    
+    if (ok && legacyDataLoaded) {
+        unlink(FILENAME);
+        legacyDataLoaded = 0;
+    }
+    
+    // Make the renames themselves durable
+    int directory = open(".", O_RDONLY);
+    if (directory != -1) {
+        fsync(directory);
+        fsyncCount++;
+        METRIC_SYNC(IO_SNAPSHOT);
+        close(directory);
+    }
+    return ok;
+}
+
+// Converts a version 1 balance (double kwacha) to ngwee, rounding to the
+// nearest ngwee.
+long long legacyMoneyToNgwee(double kwacha) {
+    return (long long)(kwacha * 100 + (kwacha < 0 ? -0.5 : 0.5));
+}
+
+void legacyAccountToRecord(const LegacyAccount *legacy, AccountRecord *record) {
+    memset(record, 0, sizeof(AccountRecord));
+    memcpy(record->fullName, legacy->fullName, MAX_NAME_LENGTH);
+    record->accountNumber = legacy->accountNumber;
+    memcpy(record->password, legacy->password, MAX_PASSWORD_LENGTH);
+    record->balance = legacyMoneyToNgwee(legacy->balance);
+    record->isActive = legacy->isActive;
+}
+
+// Checks a version 3 snapshot's header, checksum table and every data
+// block before any record is used. A damaged snapshot stops the program:
+// starting fresh would silently drop every account.
+void verifySnapshot(const char *path, const char *data, size_t fileSize, SnapshotHeader *header) {
+    if (fileSize < sizeof(SnapshotHeader)) {
+        printf("Error: Data file is truncated. Restore %s from a backup.\n", path);
+        exit(1);
+    }
+    memcpy(header, data, sizeof(SnapshotHeader));
+    if (header->headerCrc != crc32c(header, offsetof(SnapshotHeader, headerCrc))) {
+        printf("Error: Data file header is damaged. Restore %s from a backup.\n", path);
+        exit(1);
+    }
+    if (header->recordSize != (int)sizeof(AccountRecord)) {
+        printf("Error: Data file holds %d-byte accounts; this program uses %zu-byte accounts.\n",
+               header->recordSize, sizeof(AccountRecord));
+        exit(1);
+    }
+    
+    size_t dataSize = (size_t)header->recordCount * sizeof(AccountRecord);
+    size_t blockCount = (header->blockSize > 0) ? (dataSize + header->blockSize - 1) / header->blockSize : 0;
+    if (header->recordCount < 0 || header->blockSize <= 0 || (size_t)header->blockCount != blockCount ||
+        fileSize != sizeof(SnapshotHeader) + dataSize + blockCount * sizeof(uint32_t)) {
+        printf("Error: Data file size does not match its header. Restore %s from a backup.\n", path);
+        exit(1);
+    }
+    
+    uint32_t *stored = malloc((blockCount + 1) * sizeof(uint32_t));
+    uint32_t *actual = malloc((blockCount + 1) * sizeof(uint32_t));
+    if (stored == NULL || actual == NULL) {
+        printf("Error: Memory allocation failed.\n");
+        exit(1);
+    }
+    memcpy(stored, data + sizeof(SnapshotHeader) + dataSize, blockCount * sizeof(uint32_t));
+    if (crc32c(stored, blockCount * sizeof(uint32_t)) != header->tableCrc) {
+        printf("Error: Data file checksum table is damaged. Restore %s from a backup.\n", path);
+        exit(1);
+    }
+    
+    crc32cBlocks(data + sizeof(SnapshotHeader), dataSize, header->blockSize, actual);
+    for (size_t block = 0; block < blockCount; block++) {
+        if (actual[block] != stored[block]) {
+            size_t firstAccount = block * header->blockSize / sizeof(AccountRecord);
+            size_t lastAccount = ((block + 1) * header->blockSize - 1) / sizeof(AccountRecord);
+            if (lastAccount >= (size_t)header->recordCount) lastAccount = header->recordCount - 1;
+            printf("Error: Data file block %zu (accounts %zu-%zu) failed its checksum. Restore %s from a backup.\n",
+                   block, firstAccount + 1, lastAccount + 1, path);
+            exit(1);
+        }
+    }
+    free(stored);
+    free(actual);
+}
+
+// Loads a snapshot from before the shards: FILENAME holds the whole book.
+// Maps it and reads all records in one pass, so startup cost is bounded
+// by page-in speed rather than one stdio call per account. A version 3
+// snapshot is verified against its checksums first; older ones only have
+// the count header checked against the file size. Version 1 (no header,
+// double balances) and version 2 (no checksums) snapshots are converted
+// on load. Every shard is marked dirty, so the first checkpoint splits
+// the book into shard files and then removes FILENAME.
+void loadSingleSnapshot() {
+    int fd = open(FILENAME, O_RDONLY);
+    if (fd == -1) {
+        printf("No existing data found. Starting fresh.\n");
+        return;
+    }
+    
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(int)) {
+        printf("Error: Data file is damaged. Starting fresh.\n");
+        close(fd);
+        return;
+    }
+    
+    size_t fileSize = info.st_size;
+    const char *data = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        printf("Error: Could not read data file.\n");
+        return;
+    }
+    madvise((void *)data, fileSize, MADV_SEQUENTIAL);
+    METRIC_IO(IO_SNAPSHOT, 0, fileSize);
+    
+    FileHeader header;
+    int legacy = 1;
+    if (fileSize >= sizeof(FileHeader) + sizeof(int)) {
+        memcpy(&header, data, sizeof(FileHeader));
+        legacy = (header.magic != SNAPSHOT_MAGIC);
+    }
+    if (!legacy && header.version != FILE_FORMAT_VERSION && header.version != SNAPSHOT_FORMAT_VERSION) {
+        printf("Error: Data file version %d is not supported.\n", header.version);
+        munmap((void *)data, fileSize);
+        exit(1);
+    }
+    int checksummed = (!legacy && header.version == SNAPSHOT_FORMAT_VERSION);
+    
+    size_t headerSize = legacy ? sizeof(int) : sizeof(FileHeader) + sizeof(int);
+    size_t recordSize = legacy ? sizeof(LegacyAccount) : sizeof(AccountRecord);
+    int savedCount;
+    if (checksummed) {
+        SnapshotHeader snapshotHeader;
+        verifySnapshot(FILENAME, data, fileSize, &snapshotHeader);
+        headerSize = sizeof(SnapshotHeader);
+        savedCount = snapshotHeader.recordCount;
+    } else {
+        memcpy(&savedCount, data + headerSize - sizeof(int), sizeof(int));
+    }
+    size_t storedRecords = (fileSize - headerSize) / recordSize;
+    if (!checksummed && (savedCount < 0 || (size_t)savedCount != storedRecords ||
+        (fileSize - headerSize) % recordSize != 0)) {
+        printf("Warning: Data file header says %d accounts but the file holds %zu. Loading the complete records only.\n",
+               savedCount, storedRecords);
+        if (savedCount < 0 || (size_t)savedCount > storedRecords) {
+            savedCount = (int)storedRecords;
+        }
+    }
+    
+    int capacity = (savedCount > 0) ? savedCount : 10;
+    if (!growAccountStorage(capacity)) {
+        printf("Error: Memory allocation failed.\n");
+        munmap((void *)data, fileSize);
+        return;
+    }
+    
+    const char *cursor = data + headerSize;
+    AccountRecord record;
+    for (int i = 0; i < savedCount; i++) {
+        if (legacy) {
+            LegacyAccount old;
+            memcpy(&old, cursor, sizeof(LegacyAccount));
+            legacyAccountToRecord(&old, &record);
+        } else {
+            memcpy(&record, cursor, sizeof(AccountRecord));
+        }
+        if (!storeAccountRecord(i, &record)) {
+            printf("Error: Memory allocation failed. Loaded %d of %d accounts.\n", i, savedCount);
+            savedCount = i;
+            break;
+        }
+        historyHeads[i] = -1;
+        reserveAccountNumber(record.accountNumber);
+        cursor += recordSize;
+    }
+    munmap((void *)data, fileSize);
+    
+    accountCount = savedCount;
+    rebuildAccountIndex();
+    rebuildNameIndex();
+    printf("Loaded %d accounts from file.\n", accountCount);
+    if (!checksummed) {
+        printf("Converted account data to the version %d format.\n", SNAPSHOT_FORMAT_VERSION);
+    }
+    if (!rebuildShards(1)) {
+        printf("Error: Memory allocation failed.\n");
+        exit(1);
+    }
+    printf("Splitting account data into %d shard files.\n", ACCOUNT_SHARDS);
+    legacyDataLoaded = 1;
+}
+
+typedef struct {
+    int shard;
+    const char *data;  // mapped shard file, NULL if the shard has none
+    size_t size;
+    int count;
+} ShardLoad;
+
+// Maps one shard file and verifies it; runs on its own thread
+void *mapShardMain(void *arg) {
+    ShardLoad *load = arg;
+    char path[64];
+    snprintf(path, sizeof(path), SNAPSHOT_SHARD_FILE, load->shard);
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        printf("Error: Could not read %s.\n", path);
+        exit(1);
+    }
+    load->size = info.st_size;
+    load->data = mmap(NULL, load->size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (load->data == MAP_FAILED) {
+        printf("Error: Could not read %s.\n", path);
+        exit(1);
+    }
+    METRIC_IO(IO_SNAPSHOT, 0, load->size);
+    
+    SnapshotHeader header;
+    memcpy(&header, load->data, (load->size < sizeof(SnapshotHeader)) ? load->size : sizeof(SnapshotHeader));
+    if (load->size >= sizeof(SnapshotHeader) &&
+        (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_FORMAT_VERSION)) {
+        printf("Error: %s is not a version %d snapshot.\n", path, SNAPSHOT_FORMAT_VERSION);
+        exit(1);
+    }
+    verifySnapshot(path, load->data, load->size, &header);
+    load->count = header.recordCount;
+    return NULL;
+}
+
+// Loads the shard files. They are mapped and verified in parallel, one
+// thread per shard; the records are then added in shard order, since
+// interning names and updating the statistics are not thread safe.
+void loadSnapshotShards() {
+    ShardLoad loads[ACCOUNT_SHARDS];
+    pthread_t threads[ACCOUNT_SHARDS];
+    int started[ACCOUNT_SHARDS];
+    for (int i = 0; i < ACCOUNT_SHARDS; i++) {
+        memset(&loads[i], 0, sizeof(ShardLoad));
+        loads[i].shard = i;
+        started[i] = (pthread_create(&threads[i], NULL, mapShardMain, &loads[i]) == 0);
+        if (!started[i]) {
+            mapShardMain(&loads[i]);
+        }
+    }
+    
+    int total = 0;
+    int found = 0;
+    for (int i = 0; i < ACCOUNT_SHARDS; i++) {
+        if (started[i]) pthread_join(threads[i], NULL);
+        if (loads[i].data != NULL) found++;
+        total += loads[i].count;
+    }
+    if (found == 0) {
+        printf("No existing data found. Starting fresh.\n");
+        return;
+    }
+    if (!growAccountStorage((total > 0) ? total : 10) || !reserveNameSlots(total)) {
+        printf("Error: Memory allocation failed.\n");
+        exit(1);
+    }
+    
+    int misplaced = 0;
+    AccountRecord record;
+    for (int i = 0; i < ACCOUNT_SHARDS; i++) {
+        const char *cursor = loads[i].data + sizeof(SnapshotHeader);
+        for (int j = 0; j < loads[i].count; j++) {
+            memcpy(&record, cursor, sizeof(AccountRecord));
+            if (!storeAccountRecord(accountCount, &record)) {
+                printf("Error: Memory allocation failed.\n");
+                exit(1);
+            }
+            historyHeads[accountCount] = -1;
+            reserveAccountNumber(record.accountNumber);
+            misplaced += (accountShard(record.accountNumber) != i);
+            accountCount++;
+            cursor += sizeof(AccountRecord);
+        }
+        if (loads[i].data != NULL) {
+            munmap((void *)loads[i].data, loads[i].size);
+        }
+    }
+    
+    rebuildAccountIndex();
+    rebuildNameIndex();
+    if (!rebuildShards(misplaced > 0)) {
+        printf("Error: Memory allocation failed.\n");
+        exit(1);
+    }
+    printf("Loaded %d accounts from %d shard files.\n", accountCount, found);
+    if (misplaced > 0) {
+        // Written by a build with another shard count; rewrite them all
+        printf("Warning: %d accounts are in the wrong shard file. Rewriting all shards.\n", misplaced);
+        legacyDataLoaded = 1;
+    }
+}
+
+void loadDataFromFile() {
+    METRIC_SCOPE(METRIC_LOAD_SNAPSHOT, 0);
+    if (access(FILENAME, F_OK) == 0) {
+        loadSingleSnapshot();
+    } else {
+        loadSnapshotShards();
+    }
+}
+
+// Write-ahead log functions
+void openWriteAheadLog() {
+    walFile = fopen(WAL_FILE, "ab");
+    if (walFile == NULL) {
+        printf("Error: Could not open write-ahead log. Changes will be refused until it can be.\n");
+        return;
+    }
+    
+    fseek(walFile, 0, SEEK_END);
+    if (ftell(walFile) == 0) {
+        FileHeader header = {WAL_MAGIC, FILE_FORMAT_VERSION};
+        fwrite(&header, sizeof(FileHeader), 1, walFile);
+        fflush(walFile);
+    }
+    walFileSize = ftell(walFile);
+}
+
+// Reads the next redo record, converting version 1 records on the fly.
+int readWalRecord(FILE *file, int legacy, WalRecord *record) {
+    if (!legacy) {
+        METRIC_IO(IO_WAL, 0, sizeof(WalRecord));
+        return fread(record, sizeof(WalRecord), 1, file) == 1;
+    }
+    
+    LegacyWalRecord old;
+    METRIC_IO(IO_WAL, 0, sizeof(LegacyWalRecord));
+    if (fread(&old, sizeof(LegacyWalRecord), 1, file) != 1) {
+        return 0;
+    }
+    record->batchRemaining = old.batchRemaining;
+    legacyAccountToRecord(&old.account, &record->account);
+    return 1;
+}
+
+// Applies the log on top of the snapshot that loadDataFromFile just read.
+void replayWriteAheadLog() {
+    FILE *file = fopen(WAL_FILE, "rb");
+    if (file == NULL) {
+        return;
+    }
+    
+    // Logs without a header were written by version 1
+    FileHeader header;
+    int legacy = (fread(&header, sizeof(FileHeader), 1, file) != 1 || header.magic != WAL_MAGIC);
+    if (legacy) {
+        rewind(file);
+    }
+    
+    WalRecord batch[WAL_MAX_BATCH];
+    int batchSize = 0;
+    int replayed = 0;
+    int damaged = 0;
+    WalRecord record;
+    
+    while (readWalRecord(file, legacy, &record)) {
+        if (batchSize >= WAL_MAX_BATCH || record.batchRemaining < 0 || record.batchRemaining >= WAL_MAX_BATCH) {
+            printf("Warning: Write-ahead log is corrupt. Stopped replay after %d records.\n", replayed);
+            batchSize = 0;
+            damaged = 1;
+            break;
+        }
+        batch[batchSize++] = record;
+        if (record.batchRemaining != 0) {
+            continue;
+        }
+        
+        for (int i = 0; i < batchSize; i++) {
+            int position = findAccountIndex(batch[i].account.accountNumber);
+            if (position == -1) {
+                addAccount(&batch[i].account);
+            } else if (!storeAccountRecord(position, &batch[i].account)) {
+                printf("Warning: Could not replay the change to account %lld.\n", batch[i].account.accountNumber);
+            } else {
+                markShardsDirty(&position, 1);
+            }
+        }
+        replayed += batchSize;
+        batchSize = 0;
+    }
+    fclose(file);
+    
+    // A trailing partial batch is a write that never completed; drop it
+    if (batchSize > 0) {
+        printf("Warning: Discarded %d records of an incomplete write.\n", batchSize);
+        damaged = 1;
+    }
+    
+    if (replayed > 0) {
+        printf("Replayed %d logged changes.\n", replayed);
+    }
+    if (replayed > 0 || damaged || legacy) {
+        checkpoint();
+    }
+}
+
+// Stops appending to a log that could not be written or synced. Changes
+// are refused until runPendingCheckpoint has saved a snapshot and started
+// a fresh log. Caller holds logLock.
+void abandonWriteAheadLog() {
+    if (walFile != NULL) {
+        fclose(walFile);
+        walFile = NULL;
+    }
+    __atomic_store_n(&checkpointPending, 1, __ATOMIC_RELEASE);
+}
+
+// Appends the current state of the given accounts (at most WAL_MAX_BATCH)
+// as one batch. Only the changed accounts are written, so the cost does
+// not grow with the book. Returns 0 if the change could not be made
+// durable; the caller must undo it in memory. Changes are refused until
+// runPendingCheckpoint has started a fresh log, since a snapshot taken
+// here could catch other operations half applied.
+int logAccountChanges(const int *positions, int count) {
+    METRIC_SCOPE(METRIC_WAL_APPEND, 0);
+    if (walFile == NULL) {
+        abandonWriteAheadLog();
+        return 0;
+    }
+    markShardsDirty(positions, count);
+    
+    WalRecord batch[WAL_MAX_BATCH];
+    for (int i = 0; i < count; i++) {
+        batch[i].batchRemaining = count - 1 - i;
+        loadAccountRecord(positions[i], &batch[i].account);
+    }
+    
+    if (fwrite(batch, sizeof(WalRecord), count, walFile) != (size_t)count || fflush(walFile) != 0) {
+        printf("Error: Could not write to the write-ahead log.\n");
+        // Cut off whatever part of the batch reached the file
+        abandonWriteAheadLog();
+        if (walFileSize < 0 || truncate(WAL_FILE, walFileSize) != 0) {
+            printf("Error: Could not remove the failed write from the write-ahead log.\n");
+        }
+        return 0;
+    }
+    
+    walRecordCount += count;
+    walFileSize += count * sizeof(WalRecord);
+    bytesWritten += count * sizeof(WalRecord);
+    METRIC_IO(IO_WAL, 1, count * sizeof(WalRecord));
+    if (walRecordCount >= WAL_CHECKPOINT_THRESHOLD) {
+        __atomic_store_n(&checkpointPending, 1, __ATOMIC_RELEASE);
+    }
+    return 1;
+}
+
+// Runs a checkpoint requested by logAccountChanges, which also reopens a
+// log that could not be written. Called by operations after releasing
+// their locks: the exclusive lock guarantees no operation is half applied
+// while the snapshot is written.
+void runPendingCheckpoint() {
+    if (!__atomic_load_n(&checkpointPending, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    
+    pthread_rwlock_wrlock(&accountsLock);
+    pthread_mutex_lock(&logLock);
+    if (checkpointPending) {
+        checkpoint();
+        __atomic_store_n(&checkpointPending, 0, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&logLock);
+    pthread_rwlock_unlock(&accountsLock);
+}
+
+// Folds the log into a fresh snapshot and starts an empty log. Returns 0
+// if the snapshot could not be saved; the old snapshot and log still hold.
+int checkpoint() {
+    if (!saveDataToFile()) {
+        return 0;
+    }
+    
+    if (walFile != NULL) {
+        fclose(walFile);
+    }
+    walFile = fopen(WAL_FILE, "wb");
+    FileHeader header = {WAL_MAGIC, FILE_FORMAT_VERSION};
+    if (walFile == NULL || fwrite(&header, sizeof(FileHeader), 1, walFile) != 1 || fflush(walFile) != 0) {
+        // The snapshot already holds every change; a stale log must not
+        // be replayed over it
+        printf("Error: Could not reset write-ahead log.\n");
+        if (walFile != NULL) {
+            fclose(walFile);
+            walFile = NULL;
+        }
+        remove(WAL_FILE);
+    }
+    walRecordCount = 0;
+    walFileSize = sizeof(FileHeader);
+    return 1;
+}
+
+// History record encoding
+// A record is a tag byte, holding the type code and RECORD_HAS_TARGET,
+// followed by varints: the account number less ACCOUNT_NUMBER_BASE, the
+// amount, the balance after, the timestamp less the segment's
+// baseTimestamp and, if tagged, the counterparty less ACCOUNT_NUMBER_BASE.
+// Signed values are zigzag encoded, so small ones of either sign stay
+// short; a typical record takes 12 to 17 bytes.
+#define RECORD_TYPE_MASK 0x0F
+#define RECORD_HAS_TARGET 0x10
+#define RECORD_MAX_BYTES (1 + 5 * 10)
+
+unsigned long long zigzagEncode(long long value) {
+    return ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63);
+}
+
+long long zigzagDecode(unsigned long long value) {
+    return (long long)(value >> 1) ^ -(long long)(value & 1);
+}
+
+unsigned char *putVarint(unsigned char *out, unsigned long long value) {
+    while (value >= 0x80) {
+        *out++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (unsigned char)value;
+    return out;
+}
+
+// Reads a varint at *cursor, advancing it, or returns 0 if it runs past
+// end or is longer than ten bytes.
+int getVarint(const unsigned char **cursor, const unsigned char *end, unsigned long long *value) {
+    const unsigned char *p = *cursor;
+    if (p < end && *p < 0x80) {
+        *value = *p;
+        *cursor = p + 1;
+        return 1;
+    }
+    unsigned long long result = 0;
+    for (int shift = 0; shift < 70 && p < end; shift += 7) {
+        unsigned char byte = *p++;
+        result |= (unsigned long long)(byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            *value = result;
+            *cursor = p;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// getVarint without bounds checks, for callers that know a whole record's
+// worth of bytes follows. Returns the byte after the varint, or NULL if it
+// is longer than ten bytes.
+const unsigned char *getVarintUnchecked(const unsigned char *p, unsigned long long *value) {
+    unsigned long long result = *p & 0x7F;
+    if (*p++ < 0x80) {
+        *value = result;
+        return p;
+    }
+    for (int shift = 7; shift < 70; shift += 7) {
+        unsigned char byte = *p++;
+        result |= (unsigned long long)(byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            *value = result;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Encodes trans into out (at least RECORD_MAX_BYTES) and returns its length
+int encodeTransaction(const Transaction *trans, long long baseTimestamp, unsigned char *out) {
+    unsigned char *p = out;
+    *p++ = (unsigned char)(trans->type | (trans->targetAccount != 0 ? RECORD_HAS_TARGET : 0));
+    p = putVarint(p, zigzagEncode(trans->accountNumber - ACCOUNT_NUMBER_BASE));
+    p = putVarint(p, zigzagEncode(trans->amount));
+    p = putVarint(p, zigzagEncode(trans->balanceAfter));
+    p = putVarint(p, zigzagEncode((long long)trans->timestamp - baseTimestamp));
+    if (trans->targetAccount != 0) {
+        p = putVarint(p, zigzagEncode(trans->targetAccount - ACCOUNT_NUMBER_BASE));
+    }
+    return (int)(p - out);
+}
+
+// Decodes the record at data into trans. Returns its length, or 0 if the
+// bytes up to end do not hold a whole, valid record.
+int decodeTransaction(const unsigned char *data, const unsigned char *end, long long baseTimestamp,
+                      Transaction *trans) {
+    const unsigned char *p = data;
+    if (p >= end || (*p & RECORD_TYPE_MASK) >= TRANSACTION_TYPES || (*p & ~(RECORD_TYPE_MASK | RECORD_HAS_TARGET))) {
+        return 0;
+    }
+    unsigned char tag = *p++;
+    unsigned long long account, amount, balance, timestamp, target = 0;
+    if (end - data >= RECORD_MAX_BYTES) {
+        // Fast path: the whole record is in the buffer whatever its length
+        if ((p = getVarintUnchecked(p, &account)) == NULL || (p = getVarintUnchecked(p, &amount)) == NULL ||
+            (p = getVarintUnchecked(p, &balance)) == NULL || (p = getVarintUnchecked(p, &timestamp)) == NULL ||
+            ((tag & RECORD_HAS_TARGET) && (p = getVarintUnchecked(p, &target)) == NULL)) {
+            return 0;
+        }
+    } else if (!getVarint(&p, end, &account) || !getVarint(&p, end, &amount) ||
+               !getVarint(&p, end, &balance) || !getVarint(&p, end, &timestamp) ||
+               ((tag & RECORD_HAS_TARGET) && !getVarint(&p, end, &target))) {
+        return 0;
+    }
+    trans->type = (TransactionType)(tag & RECORD_TYPE_MASK);
+    trans->accountNumber = zigzagDecode(account) + ACCOUNT_NUMBER_BASE;
+    trans->amount = zigzagDecode(amount);
+    trans->balanceAfter = zigzagDecode(balance);
+    trans->timestamp = (time_t)(zigzagDecode(timestamp) + baseTimestamp);
+    trans->targetAccount = (tag & RECORD_HAS_TARGET) ? zigzagDecode(target) + ACCOUNT_NUMBER_BASE : 0;
+    return (int)(p - data);
+}
+
+// Version 2 records name their type; anything unrecognized is filed by
+// the sign of its amount.
+void fixedToTransaction(const FixedTransaction *fixed, Transaction *trans) {
+    trans->type = (fixed->amount < 0) ? TRANSACTION_WITHDRAWAL : TRANSACTION_DEPOSIT;
+    for (int type = 0; type < TRANSACTION_TYPES; type++) {
+        if (strncmp(fixed->transactionType, transactionTypeNames[type], sizeof(fixed->transactionType)) == 0) {
+            trans->type = (TransactionType)type;
+            break;
+        }
+    }
+    trans->accountNumber = fixed->accountNumber;
+    trans->amount = fixed->amount;
+    trans->balanceAfter = fixed->balanceAfter;
+    trans->timestamp = fixed->timestamp;
+    trans->targetAccount = fixed->targetAccount;
+}
+
+// Reads a segment's records in order through a buffer, decoding them in
+// place; the records a reader may use are counted by the caller.
+typedef struct {
+    int fd;
+    long long baseTimestamp;
+    size_t start;
+    size_t end;
+    int eof;
+    unsigned char buffer[HISTORY_READ_BUFFER];
+} HistoryReader;
+
+// Opens segment for reading from its first record. Returns 0 if the
+// segment cannot be opened or its header read.
+int openHistoryReader(HistoryReader *reader, int segment) {
+    char name[64];
+    SegmentHeader header;
+    historySegmentName(segment, name, sizeof(name));
+    reader->fd = open(name, O_RDONLY);
+    if (reader->fd == -1) return 0;
+    if (read(reader->fd, &header, sizeof(header)) != (ssize_t)sizeof(header)) {
+        close(reader->fd);
+        reader->fd = -1;
+        return 0;
+    }
+    reader->baseTimestamp = header.baseTimestamp;
+    reader->start = 0;
+    reader->end = 0;
+    reader->eof = 0;
+    return 1;
+}
+
+// Decodes the next record into trans. Returns its length, or 0 at the end
+// of the segment or at a record that does not decode.
+int readHistoryRecord(HistoryReader *reader, Transaction *trans) {
+    if (reader->end - reader->start < RECORD_MAX_BYTES && !reader->eof) {
+        memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+        ssize_t got = read(reader->fd, reader->buffer + reader->end, sizeof(reader->buffer) - reader->end);
+        if (got <= 0) {
+            reader->eof = 1;
+        } else {
+            reader->end += got;
+            METRIC_IO(IO_HISTORY, 0, got);
+        }
+    }
+    int length = decodeTransaction(reader->buffer + reader->start, reader->buffer + reader->end,
+                                   reader->baseTimestamp, trans);
+    reader->start += length;
+    return length;
+}
+
+void closeHistoryReader(HistoryReader *reader) {
+    if (reader->fd != -1) close(reader->fd);
+    reader->fd = -1;
+}
+
+// Transaction appender functions
+long long currentTimeMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+void historySegmentName(int segment, char *name, size_t size) {
+    snprintf(name, size, TRANSACTION_SEGMENT_FILE, segment);
+}
+
+FILE *openHistorySegment(int segment, const char *mode) {
+    char name[64];
+    historySegmentName(segment, name, sizeof(name));
+    return fopen(name, mode);
+}
+
+// Start of the local day after the one containing t
+time_t nextLocalMidnight(time_t t) {
+    struct tm day;
+    localtime_r(&t, &day);
+    day.tm_hour = 0;
+    day.tm_min = 0;
+    day.tm_sec = 0;
+    day.tm_mday++;
+    day.tm_isdst = -1;
+    return mktime(&day);
+}
+
+// Makes room for one more entry in the segment table and returns it,
+// initialized as an empty segment, or NULL if memory ran out.
+SegmentHeader *addHistorySegment() {
+    if (historySegmentCount == historySegmentCapacity) {
+        int newCapacity = (historySegmentCapacity == 0) ? 16 : historySegmentCapacity * 2;
+        SegmentHeader *newSegments = realloc(historySegments, newCapacity * sizeof(SegmentHeader));
+        if (newSegments == NULL) {
+            return NULL;
+        }
+        historySegments = newSegments;
+        historySegmentCapacity = newCapacity;
+    }
+    SegmentHeader *header = &historySegments[historySegmentCount];
+    header->magic = HISTORY_SEGMENT_MAGIC;
+    header->version = HISTORY_FORMAT_VERSION;
+    header->segmentNumber = historySegmentCount;
+    header->recordCount = 0;
+    header->minTimestamp = LLONG_MAX;
+    header->maxTimestamp = LLONG_MIN;
+    header->baseTimestamp = 0;
+    header->dataBytes = 0;
+    historySegmentCount++;
+    return header;
+}
+
+void resetHistorySegments() {
+    free(historySegments);
+    historySegments = NULL;
+    historySegmentCount = 0;
+    historySegmentCapacity = 0;
+}
+
+// Deletes every segment file and the index
+void removeHistorySegments() {
+    char name[64];
+    for (int segment = 0; ; segment++) {
+        historySegmentName(segment, name, sizeof(name));
+        if (unlink(name) != 0) break;
+    }
+    unlink(TRANSACTION_INDEX_FILE);
+}
+
+// Creates the next segment file and makes it the append target
+int startHistorySegment() {
+    SegmentHeader *header = addHistorySegment();
+    if (header == NULL) {
+        return 0;
+    }
+    historyAppendFile = openHistorySegment(header->segmentNumber, "wb");
+    if (historyAppendFile == NULL) {
+        historySegmentCount--;
+        return 0;
+    }
+    setvbuf(historyAppendFile, NULL, _IOFBF, APPENDER_BUFFER_SIZE);
+    fwrite(header, sizeof(SegmentHeader), 1, historyAppendFile);
+    fflush(historyAppendFile);
+    historyEndOffset = HISTORY_DATA_START;
+    return 1;
+}
+
+// Writes the active segment's header and closes it. With sync set its
+// records are made durable first, since later commits only fsync the
+// segment that replaces it.
+int closeHistorySegment(int sync) {
+    if (historyAppendFile == NULL) return 1;
+    
+    int ok = (fflush(historyAppendFile) == 0);
+    ok = ok && pwrite(fileno(historyAppendFile), &historySegments[historySegmentCount - 1],
+                      sizeof(SegmentHeader), 0) == (ssize_t)sizeof(SegmentHeader);
+    if (ok && sync) {
+        ok = (fsync(fileno(historyAppendFile)) == 0);
+        fsyncCount++;
+        METRIC_SYNC(IO_HISTORY);
+    }
+    fclose(historyAppendFile);
+    historyAppendFile = NULL;
+    return ok;
+}
+
+// Reopens the last segment for appending, or starts segment 0
+int resumeHistorySegment() {
+    if (historySegmentCount == 0) {
+        return startHistorySegment();
+    }
+    
+    const SegmentHeader *header = &historySegments[historySegmentCount - 1];
+    historyAppendFile = openHistorySegment(header->segmentNumber, "r+b");
+    if (historyAppendFile == NULL) {
+        return 0;
+    }
+    setvbuf(historyAppendFile, NULL, _IOFBF, APPENDER_BUFFER_SIZE);
+    fseek(historyAppendFile, 0, SEEK_END);
+    historyEndOffset = ftell(historyAppendFile);
+    if (header->recordCount > 0) {
+        activeSegmentDayEnd = nextLocalMidnight((time_t)header->minTimestamp);
+    }
+    return 1;
+}
+
+// Writes one record to the active segment, first closing it and starting
+// the next one if the record would take it past historySegmentMaxBytes or
+// falls on a later day. Returns the record's location, or -1.
+long writeHistoryRecord(const Transaction *trans) {
+    SegmentHeader *active = &historySegments[historySegmentCount - 1];
+    unsigned char record[RECORD_MAX_BYTES];
+    int length = encodeTransaction(trans, active->baseTimestamp, record);
+    if (active->recordCount > 0 &&
+        (historyEndOffset + length > historySegmentMaxBytes || trans->timestamp >= activeSegmentDayEnd)) {
+        if (!closeHistorySegment(durabilityMode != DURABILITY_OS) || !startHistorySegment()) {
+            printf("Error: Could not start a new transaction history segment.\n");
+            return -1;
+        }
+        active = &historySegments[historySegmentCount - 1];
+    }
+    
+    if (active->recordCount == 0) {
+        // The first record fixes the base its successors are stored against
+        active->baseTimestamp = trans->timestamp;
+        length = encodeTransaction(trans, active->baseTimestamp, record);
+        if (pwrite(fileno(historyAppendFile), active, sizeof(SegmentHeader), 0) != (ssize_t)sizeof(SegmentHeader)) {
+            return -1;
+        }
+        activeSegmentDayEnd = nextLocalMidnight(trans->timestamp);
+    }
+    if (fwrite(record, length, 1, historyAppendFile) != 1) {
+        return -1;
+    }
+    active->recordCount++;
+    active->dataBytes += length;
+    if (trans->timestamp < active->minTimestamp) active->minTimestamp = trans->timestamp;
+    if (trans->timestamp > active->maxTimestamp) active->maxTimestamp = trans->timestamp;
+    
+    long location = HISTORY_LOCATION(historySegmentCount - 1, historyEndOffset);
+    historyEndOffset += length;
+    bytesWritten += length;
+    METRIC_IO(IO_HISTORY, 1, length);
+    return location;
+}
+
+// Opens the index for appending and reopens the last history segment.
+// The segment table must already be loaded.
+void openTransactionAppender() {
+    indexAppendFile = fopen(TRANSACTION_INDEX_FILE, "ab");
+    if (indexAppendFile == NULL || !resumeHistorySegment()) {
+        printf("Error: Could not open transaction history for writing.\n");
+        closeTransactionAppender();
+        return;
+    }
+    
+    setvbuf(indexAppendFile, NULL, _IOFBF, APPENDER_BUFFER_SIZE);
+    fseek(indexAppendFile, 0, SEEK_END);
+    indexEndOffset = ftell(indexAppendFile);
+    lastCommitMs = currentTimeMs();
+}
+
+// Hands buffered records to the OS so readers of the files can see them.
+void flushTransactionAppender() {
+    if (historyAppendFile != NULL) fflush(historyAppendFile);
+    if (indexAppendFile != NULL) fflush(indexAppendFile);
+}
+
+// Makes every record appended so far durable. The history file and the
+// write-ahead log are synced first; the index only needs flushing, since
+// loadHistoryIndex can rebuild any tail of it from the history file.
+// Returns 0 if they may not have reached the disk; the log is then
+// abandoned, so no later change is acknowledged on top of it.
+int commitPendingWrites() {
+    METRIC_SCOPE(METRIC_COMMIT, 0);
+    int ok = 1;
+    if (historyAppendFile != NULL) {
+        ok = (fflush(historyAppendFile) == 0);
+        if (ok) {
+            ok = (fsync(fileno(historyAppendFile)) == 0);
+            fsyncCount++;
+            METRIC_SYNC(IO_HISTORY);
+        }
+    }
+    if (walFile != NULL) {
+        ok = (fsync(fileno(walFile)) == 0) && ok;
+        fsyncCount++;
+        METRIC_SYNC(IO_WAL);
+    }
+    if (indexAppendFile != NULL) {
+        fflush(indexAppendFile);
+    }
+    
+    lastCommitMs = currentTimeMs();
+    if (!ok) {
+        printf("Error: Could not sync the transaction log to disk.\n");
+        abandonWriteAheadLog();
+        uncommittedRecords = 0;
+        return 0;
+    }
+    committedRecordCount += uncommittedRecords;
+    uncommittedRecords = 0;
+    commitCount++;
+    return 1;
+}
+
+// Asks the writer for a pass covering every operation up to ticket.
+// Caller holds logLock.
+void requestPersist(long long ticket) {
+    pthread_mutex_lock(&persistLock);
+    if (ticket > persistRequested) {
+        persistRequested = ticket;
+        pthread_cond_signal(&persistWork);
+    }
+    pthread_mutex_unlock(&persistLock);
+}
+
+// Called once at the end of each customer operation, under logLock, after
+// all of its log records have been appended. Returns a ticket to pass to
+// awaitCommit() once the operation has released its locks, 0 when there
+// is nothing to wait for, or COMMIT_FAILED. Without the writer thread the
+// records are synced here, as before.
+long long commitOperation() {
+    long long ticket = ++loggedOperations;
+    switch (durabilityMode) {
+        case DURABILITY_FSYNC_EACH:
+            if (!persistWriterRunning) {
+                return commitPendingWrites() ? 0 : COMMIT_FAILED;
+            }
+            requestPersist(ticket);
+            return ticket;
+        case DURABILITY_GROUP:
+            if (!persistWriterRunning) {
+                if ((uncommittedRecords >= groupCommitRecords ||
+                     currentTimeMs() - lastCommitMs >= groupCommitIntervalMs) && !commitPendingWrites()) {
+                    return COMMIT_FAILED;
+                }
+            } else if (uncommittedRecords >= groupCommitRecords) {
+                requestPersist(ticket);
+            }
+            return 0;
+        case DURABILITY_OS:
+            committedRecordCount += uncommittedRecords;
+            uncommittedRecords = 0;
+            return 0;
+    }
+    return 0;
+}
+
+// Blocks until the writer has made the operation with this ticket durable.
+// Returns 0 if that failed; the operation then reports BANK_ERR_STORAGE.
+int awaitCommit(long long ticket) {
+    if (ticket == COMMIT_FAILED) return 0;
+    if (ticket == 0) return 1;
+    pthread_mutex_lock(&persistLock);
+    int failed = (ticket > persistFailedFrom && ticket <= persistFailedThrough);
+    while (!failed && persistDurable < ticket && persistWriterRunning) {
+        pthread_cond_wait(&persistDone, &persistLock);
+        failed = (ticket > persistFailedFrom && ticket <= persistFailedThrough);
+    }
+    pthread_mutex_unlock(&persistLock);
+    return !failed;
+}
+
+// One pass of the writer. The buffered records are handed to the OS under
+// logLock, but the fsyncs run on duplicated descriptors without it, so
+// operations keep appending (and a checkpoint may swap the WAL) while the
+// disk works. Returns the last ticket the pass covered, whether or not
+// it could make it durable.
+long long syncLogFiles(long long synced) {
+    METRIC_SCOPE(METRIC_COMMIT, 0);
+    pthread_mutex_lock(&logLock);
+    persistGroupMode = (durabilityMode == DURABILITY_GROUP);
+    persistIntervalMs = groupCommitIntervalMs;
+    long long ticket = loggedOperations;
+    if (ticket == synced) {
+        pthread_mutex_unlock(&logLock);
+        return synced;
+    }
+    
+    int historyFd = -1;
+    int walFd = -1;
+    int ok = 1;
+    if (historyAppendFile != NULL) {
+        ok = (fflush(historyAppendFile) == 0);
+        historyFd = dup(fileno(historyAppendFile));
+        ok = ok && historyFd != -1;
+    }
+    if (walFile != NULL) {
+        walFd = dup(fileno(walFile));
+        ok = ok && walFd != -1;
+    }
+    if (indexAppendFile != NULL) {
+        fflush(indexAppendFile);
+    }
+    int records = uncommittedRecords;
+    uncommittedRecords = 0;
+    pthread_mutex_unlock(&logLock);
+    
+    int syncs = 0;
+    if (historyFd != -1) {
+        ok = (fsync(historyFd) == 0) && ok;
+        close(historyFd);
+        syncs++;
+        METRIC_SYNC(IO_HISTORY);
+    }
+    if (walFd != -1) {
+        ok = (fsync(walFd) == 0) && ok;
+        close(walFd);
+        syncs++;
+        METRIC_SYNC(IO_WAL);
+    }
+    
+    pthread_mutex_lock(&logLock);
+    if (ok) {
+        committedRecordCount += records;
+        commitCount++;
+    } else {
+        // A later sync cannot vouch for pages this one lost
+        printf("Error: Could not sync the transaction log to disk.\n");
+        abandonWriteAheadLog();
+    }
+    fsyncCount += syncs;
+    lastCommitMs = currentTimeMs();
+    pthread_mutex_unlock(&logLock);
+    
+    pthread_mutex_lock(&persistLock);
+    if (ok) {
+        persistDurable = ticket;
+    } else {
+        persistFailedFrom = synced;
+        persistFailedThrough = ticket;
+    }
+    pthread_cond_broadcast(&persistDone);
+    pthread_mutex_unlock(&persistLock);
+    return ticket;
+}
+
+// Runs a pass whenever one is requested; in group commit mode also every
+// groupCommitIntervalMs, so a quiet book still reaches the disk in time.
+void *persistWriterMain(void *arg) {
+    (void)arg;
+    long long synced = 0;
+    pthread_mutex_lock(&persistLock);
+    for (;;) {
+        if (persistRequested <= synced && !persistWriterStop) {
+            if (persistGroupMode) {
+                struct timespec wake;
+                clock_gettime(CLOCK_REALTIME, &wake);
+                wake.tv_sec += persistIntervalMs / 1000;
+                wake.tv_nsec += (long)(persistIntervalMs % 1000) * 1000000L;
+                if (wake.tv_nsec >= 1000000000L) {
+                    wake.tv_sec++;
+                    wake.tv_nsec -= 1000000000L;
+                }
+                pthread_cond_timedwait(&persistWork, &persistLock, &wake);
+            } else {
+                pthread_cond_wait(&persistWork, &persistLock);
+            }
+        }
+        int stopping = persistWriterStop;
+        pthread_mutex_unlock(&persistLock);
+        synced = syncLogFiles(synced);
+        pthread_mutex_lock(&persistLock);
+        if (stopping) break;
+    }
+    pthread_mutex_unlock(&persistLock);
+    return NULL;
+}
+
+// Makes the writer pick up changed commit settings. Caller holds logLock.
+void wakePersistenceWriter() {
+    if (persistWriterRunning) {
+        requestPersist(loggedOperations);
+    }
+}
+
+void startPersistenceWriter() {
+    if (persistWriterRunning) return;
+    persistGroupMode = (durabilityMode == DURABILITY_GROUP);
+    persistIntervalMs = groupCommitIntervalMs;
+    persistWriterStop = 0;
+    persistWriterRunning = (pthread_create(&persistWriter, NULL, persistWriterMain, NULL) == 0);
+}
+
+// Stops the writer after a last pass and releases anyone still waiting.
+void stopPersistenceWriter() {
+    if (!persistWriterRunning) return;
+    pthread_mutex_lock(&persistLock);
+    persistWriterStop = 1;
+    pthread_cond_signal(&persistWork);
+    pthread_mutex_unlock(&persistLock);
+    pthread_join(persistWriter, NULL);
+    pthread_mutex_lock(&persistLock);
+    persistWriterRunning = 0;
+    pthread_cond_broadcast(&persistDone);
+    pthread_mutex_unlock(&persistLock);
+}
+
+void closeTransactionAppender() {
+    if (uncommittedRecords > 0 && durabilityMode != DURABILITY_OS) {
+        commitPendingWrites();
+    }
+    closeHistorySegment(0);
+    resetHistorySegments();
+    if (indexAppendFile != NULL) {
+        fclose(indexAppendFile);
+        indexAppendFile = NULL;
+    }
+}
+
+void displayAppenderStatistics() {
+    const char *modeNames[] = {"fsync every operation", "group commit", "OS buffered"};
+    printf("Durability Mode: %s\n", modeNames[durabilityMode]);
+    if (durabilityMode == DURABILITY_GROUP) {
+        printf("Group Size: %d records or %d ms\n", groupCommitRecords, groupCommitIntervalMs);
+    }
+    printf("Records Appended: %lld\n", appendedRecordCount);
+    printf("Records Committed: %lld\n", committedRecordCount);
+    printf("Records Pending: %d\n", uncommittedRecords);
+    printf("Group Commits: %lld (%lld fsync calls)\n", commitCount, fsyncCount);
+    if (commitCount > 0) {
+        printf("Records per commit: %.2f\n", (double)committedRecordCount / commitCount);
+    }
+    if (historySegmentCount > 0) {
+        printf("History Segments: %d (current: %ld of %ld KB)\n", historySegmentCount,
+               historyEndOffset / 1024, historySegmentMaxBytes / 1024);
+    }
+}
+
+// Appends one record to the history buffer without forcing it to disk;
+// the caller finishes the operation with commitOperation().
+void appendTransaction(long long accNum, TransactionType type, long long amount, long long newBalance, long long targetAcc) {
+    METRIC_SCOPE(METRIC_APPEND_TRANSACTION, 0);
+    if (historyAppendFile == NULL) return;
+    
+    Transaction trans;
+    trans.accountNumber = accNum;
+    trans.type = type;
+    trans.amount = amount;
+    trans.balanceAfter = newBalance;
+    trans.timestamp = time(NULL);
+    trans.targetAccount = targetAcc;
+    
+    long location = writeHistoryRecord(&trans);
+    if (location != -1) {
+        appendHistoryIndexEntry(accNum, location);
+        appendedRecordCount++;
+        uncommittedRecords++;
+    }
+}
+
+long long saveTransaction(long long accNum, TransactionType type, long long amount, long long newBalance, long long targetAcc) {
+    appendTransaction(accNum, type, amount, newBalance, targetAcc);
+    return commitOperation();
+}
+
+// History index functions
+void appendHistoryIndexEntry(long long accNum, long historyOffset) {
+    if (indexAppendFile == NULL) return;
+    
+    int position = findAccountIndex(accNum);
+    HistoryIndexEntry entry;
+    entry.accountNumber = accNum;
+    entry.historyOffset = historyOffset;
+    entry.previousEntry = (position == -1) ? -1 : historyHeads[position];
+    
+    if (fwrite(&entry, sizeof(HistoryIndexEntry), 1, indexAppendFile) == 1) {
+        if (position != -1) {
+            historyHeads[position] = indexEndOffset;
+        }
+        indexEndOffset += sizeof(HistoryIndexEntry);
+        bytesWritten += sizeof(HistoryIndexEntry);
+        METRIC_IO(IO_INDEX, 1, sizeof(HistoryIndexEntry));
+    }
+}
+
+// Splits a single-file history from before segments (version 1: no header
+// and double amounts; version 2: a FileHeader) into segments. Segments
+// already present are left from an interrupted conversion and are rebuilt;
+// the old file is removed only once every segment is on disk.
+void migrateLegacyHistory() {
+    FILE *file = fopen(TRANSACTION_HISTORY_FILE, "rb");
+    if (file == NULL) return;
+    
+    FileHeader header;
+    int legacy = (fread(&header, sizeof(FileHeader), 1, file) != 1 || header.magic != HISTORY_MAGIC);
+    if (legacy) {
+        rewind(file);
+    }
+    
+    // Every segment must be durable before the old file goes away
+    DurabilityMode savedMode = durabilityMode;
+    durabilityMode = DURABILITY_FSYNC_EACH;
+    removeHistorySegments();
+    resetHistorySegments();
+    if (!startHistorySegment()) {
+        printf("Error: Could not convert transaction history.\n");
+        fclose(file);
+        exit(1);
+    }
+    
+    Transaction trans;
+    FixedTransaction fixed;
+    LegacyTransaction old;
+    int count = 0;
+    int ok = 1;
+    while (ok) {
+        if (legacy) {
+            if (fread(&old, sizeof(LegacyTransaction), 1, file) != 1) break;
+            memset(&fixed, 0, sizeof(FixedTransaction));
+            fixed.accountNumber = old.accountNumber;
+            memcpy(fixed.transactionType, old.transactionType, sizeof(fixed.transactionType));
+            fixed.amount = legacyMoneyToNgwee(old.amount);
+            fixed.balanceAfter = legacyMoneyToNgwee(old.balanceAfter);
+            fixed.timestamp = old.timestamp;
+            fixed.targetAccount = old.targetAccount;
+        } else if (fread(&fixed, sizeof(FixedTransaction), 1, file) != 1) {
+            break;
+        }
+        fixedToTransaction(&fixed, &trans);
+        ok = (writeHistoryRecord(&trans) != -1);
+        count++;
+    }
+    fclose(file);
+    
+    int segments = historySegmentCount;
+    durabilityMode = savedMode;
+    if (!closeHistorySegment(1) || !ok) {
+        printf("Error: Could not convert transaction history.\n");
+        exit(1);
+    }
+    resetHistorySegments();
+    unlink(TRANSACTION_HISTORY_FILE);
+    printf("Converted %d transaction records into %d history segments.\n", count, segments);
+}
+
+// Converts the version 2 segment files (fixed-size records) to the
+// compact encoding, one segment at a time: each is written beside the old
+// file and renamed over it, so segments keep their records and a crash
+// leaves every segment whole in one format or the other. The index
+// points at byte offsets that are about to change, so it is removed
+// first and rebuilt by loadHistoryIndex.
+void convertFixedHistorySegments() {
+    int converted = 0;
+    long long records = 0;
+    long long oldBytes = 0;
+    long long newBytes = 0;
+    char name[64];
+    char tmpName[72];
+    
+    for (int segment = 0; ; segment++) {
+        historySegmentName(segment, name, sizeof(name));
+        int fd = open(name, O_RDONLY);
+        if (fd == -1) break;
+        FixedSegmentHeader fixedHeader;
+        struct stat info;
+        if (read(fd, &fixedHeader, sizeof(fixedHeader)) != (ssize_t)sizeof(fixedHeader) || fstat(fd, &info) != 0 ||
+            fixedHeader.magic != HISTORY_SEGMENT_MAGIC || fixedHeader.version >= HISTORY_FORMAT_VERSION) {
+            close(fd);
+            continue;
+        }
+        if (converted == 0 && unlink(TRANSACTION_INDEX_FILE) != 0 && errno != ENOENT) {
+            printf("Error: Could not convert transaction history.\n");
+            exit(1);
+        }
+        
+        // Whole records only: a torn trailing one is dropped, as a rescan would
+        size_t count = (info.st_size - sizeof(FixedSegmentHeader)) / sizeof(FixedTransaction);
+        FixedTransaction *fixed = malloc((count > 0 ? count : 1) * sizeof(FixedTransaction));
+        unsigned char *encoded = malloc(sizeof(SegmentHeader) + (count > 0 ? count : 1) * RECORD_MAX_BYTES);
+        if (fixed == NULL || encoded == NULL ||
+            pread(fd, fixed, count * sizeof(FixedTransaction), sizeof(FixedSegmentHeader)) !=
+                (ssize_t)(count * sizeof(FixedTransaction))) {
+            printf("Error: Could not convert transaction history segment %d.\n", segment);
+            exit(1);
+        }
+        close(fd);
+        
+        SegmentHeader header;
+        memset(&header, 0, sizeof(header));
+        header.magic = HISTORY_SEGMENT_MAGIC;
+        header.version = HISTORY_FORMAT_VERSION;
+        header.segmentNumber = segment;
+        header.recordCount = (int)count;
+        header.minTimestamp = LLONG_MAX;
+        header.maxTimestamp = LLONG_MIN;
+        header.baseTimestamp = (count > 0) ? (long long)fixed[0].timestamp : 0;
+        unsigned char *out = encoded + sizeof(SegmentHeader);
+        for (size_t i = 0; i < count; i++) {
+            Transaction trans;
+            fixedToTransaction(&fixed[i], &trans);
+            out += encodeTransaction(&trans, header.baseTimestamp, out);
+            if (trans.timestamp < header.minTimestamp) header.minTimestamp = trans.timestamp;
+            if (trans.timestamp > header.maxTimestamp) header.maxTimestamp = trans.timestamp;
+        }
+        header.dataBytes = out - encoded - (long long)sizeof(SegmentHeader);
+        memcpy(encoded, &header, sizeof(SegmentHeader));
+        
+        snprintf(tmpName, sizeof(tmpName), "%s.tmp", name);
+        size_t size = out - encoded;
+        int tmp = open(tmpName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int ok = (tmp != -1 && write(tmp, encoded, size) == (ssize_t)size && fsync(tmp) == 0);
+        if (tmp != -1) close(tmp);
+        if (!ok || rename(tmpName, name) != 0) {
+            printf("Error: Could not convert transaction history segment %d.\n", segment);
+            exit(1);
+        }
+        converted++;
+        records += count;
+        oldBytes += info.st_size;
+        newBytes += size;
+        free(fixed);
+        free(encoded);
+    }
+    
+    if (converted > 0) {
+        int directory = open(".", O_RDONLY);
+        if (directory != -1) {
+            fsync(directory);
+            close(directory);
+        }
+        printf("Converted %lld transaction records in %d history segments to the compact format "
+               "(%lld KB to %lld KB).\n", records, converted, oldBytes / 1024, newBytes / 1024);
+    }
+}
+
+// Recounts a segment whose header cannot be trusted, cutting off a torn
+// trailing record, and rewrites its header. header->baseTimestamp must
+// already hold the stored one.
+void rescanHistorySegment(FILE *file, SegmentHeader *header) {
+    HistoryReader reader;
+    Transaction trans;
+    header->recordCount = 0;
+    header->dataBytes = 0;
+    header->minTimestamp = LLONG_MAX;
+    header->maxTimestamp = LLONG_MIN;
+    
+    if (openHistoryReader(&reader, header->segmentNumber)) {
+        int length;
+        while ((length = readHistoryRecord(&reader, &trans)) > 0) {
+            header->recordCount++;
+            header->dataBytes += length;
+            if (trans.timestamp < header->minTimestamp) header->minTimestamp = trans.timestamp;
+            if (trans.timestamp > header->maxTimestamp) header->maxTimestamp = trans.timestamp;
+        }
+        closeHistoryReader(&reader);
+    }
+    
+    fflush(file);
+    if (ftruncate(fileno(file), HISTORY_DATA_START + header->dataBytes) != 0 ||
+        pwrite(fileno(file), header, sizeof(SegmentHeader), 0) != (ssize_t)sizeof(SegmentHeader)) {
+        printf("Warning: Could not repair transaction history segment %d.\n", header->segmentNumber);
+    }
+}
+
+// Builds the segment table from the segment files. A closed segment's
+// header is trusted when its record count matches the file size; the
+// last segment and any that disagree (a crash while rotating) are rescanned.
+void loadHistorySegments() {
+    resetHistorySegments();
+    char name[64];
+    
+    for (int segment = 0; ; segment++) {
+        FILE *file = openHistorySegment(segment, "r+b");
+        if (file == NULL) break;
+        
+        SegmentHeader *header = addHistorySegment();
+        if (header == NULL) {
+            printf("Error: Memory allocation failed!\n");
+            exit(1);
+        }
+        
+        SegmentHeader stored;
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        rewind(file);
+        if (size < HISTORY_DATA_START) {
+            // Created but never written: treat as empty
+            pwrite(fileno(file), header, sizeof(SegmentHeader), 0);
+        } else if (fread(&stored, sizeof(SegmentHeader), 1, file) != 1 ||
+                   stored.magic != HISTORY_SEGMENT_MAGIC || stored.version != HISTORY_FORMAT_VERSION) {
+            printf("Error: Transaction history segment %d is damaged.\n", segment);
+            exit(1);
+        } else {
+            historySegmentName(segment + 1, name, sizeof(name));
+            if (stored.dataBytes == size - HISTORY_DATA_START && access(name, F_OK) == 0) {
+                stored.segmentNumber = segment;
+                *header = stored;
+            } else {
+                header->baseTimestamp = stored.baseTimestamp;
+                rescanHistorySegment(file, header);
+            }
+        }
+        fclose(file);
+    }
+}
+
+// Whether a history location falls within the records on disk
+int isHistoryLocationValid(long location) {
+    int segment = LOCATION_SEGMENT(location);
+    long offset = LOCATION_OFFSET(location);
+    return segment >= 0 && segment < historySegmentCount && offset >= HISTORY_DATA_START &&
+           offset < HISTORY_DATA_START + historySegments[segment].dataBytes;
+}
+
+// Loads the segment table, rebuilds the per-account chain heads from the
+// sidecar file, then indexes any history records the sidecar is missing
+// (a new or converted history, or a crash between the two appends).
+// Entries pointing past the end of the history (index flushed, history
+// lost in a crash) are dropped.
+void loadHistoryIndex() {
+    long lastIndexed = -1;
+    long entryCount = 0;
+    
+    migrateLegacyHistory();
+    convertFixedHistorySegments();
+    loadHistorySegments();
+    
+    FILE *file = fopen(TRANSACTION_INDEX_FILE, "rb");
+    if (file != NULL) {
+        HistoryIndexEntry entry;
+        while (fread(&entry, sizeof(HistoryIndexEntry), 1, file) == 1) {
+            METRIC_IO(IO_INDEX, 0, sizeof(HistoryIndexEntry));
+            if (!isHistoryLocationValid(entry.historyOffset)) {
+                break;
+            }
+            int position = findAccountIndex(entry.accountNumber);
+            if (position != -1) {
+                historyHeads[position] = entryCount * sizeof(HistoryIndexEntry);
+            }
+            lastIndexed = entry.historyOffset;
+            entryCount++;
+        }
+        fclose(file);
+        
+        // Drop torn or dangling trailing entries so new entries stay aligned
+        truncate(TRANSACTION_INDEX_FILE, entryCount * sizeof(HistoryIndexEntry));
+    }
+    
+    openTransactionAppender();
+    
+    // Records are variable length, so the segment holding the last indexed
+    // record is decoded from its start up to that record
+    int added = 0;
+    int loadedSegments = historySegmentCount;
+    int firstSegment = (lastIndexed == -1) ? 0 : LOCATION_SEGMENT(lastIndexed);
+    for (int segment = firstSegment; segment < loadedSegments; segment++) {
+        HistoryReader reader;
+        if (!openHistoryReader(&reader, segment)) continue;
+        
+        long offset = HISTORY_DATA_START;
+        int remaining = historySegments[segment].recordCount;
+        Transaction trans;
+        int length;
+        while (remaining-- > 0 && (length = readHistoryRecord(&reader, &trans)) > 0) {
+            long location = HISTORY_LOCATION(segment, offset);
+            offset += length;
+            if (location <= lastIndexed) continue;
+            appendHistoryIndexEntry(trans.accountNumber, location);
+            added++;
+        }
+        closeHistoryReader(&reader);
+    }
+    flushTransactionAppender();
+    
+    if (added > 0) {
+        printf("Indexed %d transaction records.\n", added);
+    }
+}
+
+void printTransaction(const Transaction *trans) {
+    struct tm *timeinfo = localtime(&trans->timestamp);
+    printf("Date: %s", asctime(timeinfo));
+    printf("Type: %s\n", transactionTypeNames[trans->type]);
+    printf("Amount: K " MONEY_FMT "\n", MONEY_ARGS(trans->amount));
+    
+    if (trans->type == TRANSACTION_TRANSFER) {
+        if (trans->amount < 0) {
+            printf("Transferred to: %lld\n", trans->targetAccount);
+        } else {
+            printf("Received from: %lld\n", trans->targetAccount);
+        }
+    }
+    
+    printf("Balance After: K " MONEY_FMT "\n", MONEY_ARGS(trans->balanceAfter));
+    printf("---------------------------\n");
+}
+
+// Flushes the appender and returns, per segment, the number of records a
+// reader may use if the segment's timestamps overlap [from, to], or 0 if
+// the segment can be skipped (caller frees). *segmentCount receives the
+// number of segments. Caller holds logLock.
+int *selectHistorySegments(time_t from, time_t to, int *segmentCount) {
+    flushTransactionAppender();
+    *segmentCount = historySegmentCount;
+    int *selected = calloc(historySegmentCount + 1, sizeof(int));
+    if (selected == NULL) {
+        *segmentCount = 0;
+        return NULL;
+    }
+    for (int i = 0; i < historySegmentCount; i++) {
+        const SegmentHeader *header = &historySegments[i];
+        if (header->recordCount > 0 && header->minTimestamp <= (long long)to &&
+            header->maxTimestamp >= (long long)from) {
+            selected[i] = header->recordCount;
+        }
+    }
+    return selected;
+}
+
+// Reads an account's history by walking its index chain, so only that
+// account's records are touched, and only segments overlapping [from, to]
+// are opened. limit > 0 returns the newest limit records in the range,
+// newest first; limit 0 returns all of them in date order.
+// Returns the number of records stored in *records (caller frees), or -1
+// if there is no history to read.
+int readTransactionRange(long long accNum, time_t from, time_t to, int limit, Transaction **records) {
+    *records = NULL;
+    long entryOffset = -1;
+    int segmentCount = 0;
+    pthread_rwlock_rdlock(&accountsLock);
+    int position = findAccountIndex(accNum);
+    pthread_mutex_lock(&logLock);
+    int *selected = selectHistorySegments(from, to, &segmentCount);
+    if (position != -1) {
+        entryOffset = historyHeads[position];
+    }
+    pthread_mutex_unlock(&logLock);
+    pthread_rwlock_unlock(&accountsLock);
+    
+    FILE *index = fopen(TRANSACTION_INDEX_FILE, "rb");
+    if (index == NULL || selected == NULL || position == -1) {
+        if (index != NULL) fclose(index);
+        free(selected);
+        return -1;
+    }
+    
+    // The chain visits segments in descending order, so once it passes the
+    // oldest selected segment nothing further can match
+    int oldestSelected = 0;
+    while (oldestSelected < segmentCount && selected[oldestSelected] == 0) {
+        oldestSelected++;
+    }
+    
+    int segmentFile = -1;
+    long long baseTimestamp = 0;
+    int openSegment = -1;
+    int count = 0;
+    int capacity = 0;
+    HistoryIndexEntry entry;
+    Transaction trans;
+    unsigned char record[RECORD_MAX_BYTES];
+    
+    while (entryOffset != -1 && (limit == 0 || count < limit)) {
+        if (fseek(index, entryOffset, SEEK_SET) != 0 ||
+            fread(&entry, sizeof(HistoryIndexEntry), 1, index) != 1) {
+            break;
+        }
+        METRIC_IO(IO_INDEX, 0, sizeof(HistoryIndexEntry));
+        entryOffset = entry.previousEntry;
+        
+        int segment = LOCATION_SEGMENT(entry.historyOffset);
+        if (segment < oldestSelected) break;
+        if (segment >= segmentCount || selected[segment] == 0) continue;
+        
+        if (segment != openSegment) {
+            char name[64];
+            SegmentHeader header;
+            if (segmentFile != -1) close(segmentFile);
+            historySegmentName(segment, name, sizeof(name));
+            segmentFile = open(name, O_RDONLY);
+            if (segmentFile != -1 && pread(segmentFile, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+                close(segmentFile);
+                segmentFile = -1;
+            }
+            baseTimestamp = (segmentFile != -1) ? header.baseTimestamp : 0;
+            openSegment = segment;
+        }
+        // A record is at most RECORD_MAX_BYTES; near the end of the
+        // segment fewer come back, which the decoder checks
+        ssize_t got = (segmentFile == -1) ? -1 :
+                      pread(segmentFile, record, sizeof(record), LOCATION_OFFSET(entry.historyOffset));
+        if (got <= 0 || decodeTransaction(record, record + got, baseTimestamp, &trans) == 0) {
+            continue;
+        }
+        METRIC_IO(IO_HISTORY, 0, got);
+        if (trans.timestamp < from || trans.timestamp > to) {
+            continue;
+        }
+        
+        if (count >= capacity) {
+            capacity = (capacity == 0) ? 16 : capacity * 2;
+            Transaction *newRecords = realloc(*records, capacity * sizeof(Transaction));
+            if (newRecords == NULL) {
+                break;
+            }
+            *records = newRecords;
+        }
+        (*records)[count++] = trans;
+    }
+    
+    if (limit == 0) {
+        for (int i = 0; i < count / 2; i++) {
+            trans = (*records)[i];
+            (*records)[i] = (*records)[count - 1 - i];
+            (*records)[count - 1 - i] = trans;
+        }
+    }
+    
+    if (segmentFile != -1) close(segmentFile);
+    free(selected);
+    fclose(index);
+    return count;
+}
+
+int readTransactionHistory(long long accNum, int limit, Transaction **records) {
+    return readTransactionRange(accNum, (time_t)LLONG_MIN, (time_t)LLONG_MAX, limit, records);
+}
+
+// Totals over every record of a date range, for the admin report
+typedef struct {
+    long long records;
+    long long counts[TRANSACTION_TYPES];
+    long long amounts[TRANSACTION_TYPES];
+    int segmentsRead;
+    int segmentCount;
+} HistoryReport;
+
+// Scans the segments overlapping [from, to] in bulk and totals their
+// records in the range. Transfers are counted once, by their outgoing
+// record. Returns 0 if the history could not be read.
+int buildHistoryReport(time_t from, time_t to, HistoryReport *report) {
+    memset(report, 0, sizeof(HistoryReport));
+    int segmentCount;
+    pthread_mutex_lock(&logLock);
+    int *selected = selectHistorySegments(from, to, &segmentCount);
+    pthread_mutex_unlock(&logLock);
+    if (selected == NULL) {
+        return 0;
+    }
+    report->segmentCount = segmentCount;
+    
+    HistoryReader *reader = malloc(sizeof(HistoryReader));
+    if (reader == NULL) {
+        free(selected);
+        return 0;
+    }
+    for (int segment = 0; segment < segmentCount; segment++) {
+        if (selected[segment] == 0) continue;
+        if (!openHistoryReader(reader, segment)) continue;
+        report->segmentsRead++;
+        
+        // Stop at the record count seen under the lock; anything after it
+        // may still be half written
+        int remaining = selected[segment];
+        Transaction trans;
+        while (remaining-- > 0 && readHistoryRecord(reader, &trans) > 0) {
+            if (trans.timestamp < from || trans.timestamp > to) continue;
+            report->records++;
+            if (trans.type == TRANSACTION_TRANSFER && trans.amount > 0) continue;
+            report->counts[trans.type]++;
+            report->amounts[trans.type] += llabs(trans.amount);
+        }
+        closeHistoryReader(reader);
+    }
+    free(reader);
+    free(selected);
+    return 1;
+}
+
+// Statements
+// A statement run reads the period's history once, segment by segment,
+// groups the records by account with a counting sort, and then worker
+// threads each write the statements of one slice of the accounts. Every
+// account gets statement_<number>.txt in the output directory, and
+// statements.csv sums them all up.
+typedef struct {
+    long long openingBalance;
+    long long closingBalance;
+    long long credits;
+    long long debits;
+    int transactions;
+    int written;
+} StatementSummary;
+
+typedef struct {
+    const Transaction *records;
+    const int *order;              // record indexes grouped by account
+    const int *starts;             // order[starts[p]] .. order[starts[p + 1] - 1] belong to position p
+    const long long *numbers;
+    const char **names;
+    const long long *priorBalances; // balance before from of accounts quiet in the period
+    StatementSummary *summaries;
+    int firstPosition;
+    int endPosition;
+    const char *directory;
+    time_t from;
+    time_t to;
+    int failures;
+} StatementWorker;
+
+void formatStatementDate(time_t when, char *text, size_t size) {
+    struct tm local;
+    localtime_r(&when, &local);
+    strftime(text, size, "%Y-%m-%d %H:%M:%S", &local);
+}
+
+void *statementWorkerMain(void *arg) {
+    StatementWorker *worker = arg;
+    BulkWriter writer;
+    if (!openBulkWriter(&writer, -1)) {
+        worker->failures = worker->endPosition - worker->firstPosition;
+        return NULL;
+    }
+    
+    char path[PATH_MAX];
+    char fromText[32];
+    char toText[32];
+    formatStatementDate(worker->from, fromText, sizeof(fromText));
+    formatStatementDate(worker->to, toText, sizeof(toText));
+    
+    for (int position = worker->firstPosition; position < worker->endPosition; position++) {
+        StatementSummary *summary = &worker->summaries[position];
+        int first = worker->starts[position];
+        int end = worker->starts[position + 1];
+        
+        // Balances come from balanceAfter: the first record less its own
+        // amount opens the period, the last one closes it. A quiet account
+        // carries the balance of its last earlier record; one with no
+        // history up to the period's end gets no statement.
+        if (first < end) {
+            const Transaction *firstRecord = &worker->records[worker->order[first]];
+            summary->openingBalance = firstRecord->balanceAfter - firstRecord->amount;
+            summary->closingBalance = worker->records[worker->order[end - 1]].balanceAfter;
+        } else if (worker->priorBalances[position] != NO_PRIOR_BALANCE) {
+            summary->openingBalance = worker->priorBalances[position];
+            summary->closingBalance = worker->priorBalances[position];
+        } else {
+            continue;
+        }
+        
+        snprintf(path, sizeof(path), "%s/statement_%lld.txt", worker->directory, worker->numbers[position]);
+        writer.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (writer.fd == -1) {
+            worker->failures++;
+            continue;
+        }
+        writer.failed = 0;
+        
+        bulkPrintf(&writer, "MISHTERIOUS BANK - ACCOUNT STATEMENT\n\n");
+        bulkPrintf(&writer, "Account Holder: %s\n", worker->names[position]);
+        bulkPrintf(&writer, "Account Number: %lld\n", worker->numbers[position]);
+        bulkPrintf(&writer, "Period: %s to %s\n\n", fromText, toText);
+        bulkPrintf(&writer, "Opening Balance: K " MONEY_FMT "\n\n", MONEY_ARGS(summary->openingBalance));
+        bulkPrintf(&writer, "%-19s  %-10s  %15s  %15s  %s\n", "Date", "Type", "Amount (K)", "Balance (K)", "Account");
+        
+        for (int i = first; i < end; i++) {
+            const Transaction *trans = &worker->records[worker->order[i]];
+            char when[32];
+            char amount[32];
+            char balance[32];
+            formatStatementDate(trans->timestamp, when, sizeof(when));
+            snprintf(amount, sizeof(amount), MONEY_FMT, MONEY_ARGS(trans->amount));
+            snprintf(balance, sizeof(balance), MONEY_FMT, MONEY_ARGS(trans->balanceAfter));
+            if (trans->targetAccount != 0) {
+                bulkPrintf(&writer, "%-19s  %-10s  %15s  %15s  %lld\n",
+                           when, transactionTypeNames[trans->type], amount, balance, trans->targetAccount);
+            } else {
+                bulkPrintf(&writer, "%-19s  %-10s  %15s  %15s\n", when, transactionTypeNames[trans->type], amount, balance);
+            }
+            if (trans->amount > 0) {
+                summary->credits += trans->amount;
+            } else {
+                summary->debits -= trans->amount;
+            }
+        }
+        if (first == end) {
+            bulkPrintf(&writer, "No transactions in this period.\n");
+        }
+        summary->transactions = end - first;
+        
+        bulkPrintf(&writer, "\nTotal Credits: K " MONEY_FMT "\n", MONEY_ARGS(summary->credits));
+        bulkPrintf(&writer, "Total Debits: K " MONEY_FMT "\n", MONEY_ARGS(summary->debits));
+        bulkPrintf(&writer, "Closing Balance: K " MONEY_FMT "\n", MONEY_ARGS(summary->closingBalance));
+        flushBulkWriter(&writer);
+        
+        if (close(writer.fd) != 0 || writer.failed) {
+            worker->failures++;
+        } else {
+            summary->written = 1;
+        }
+    }
+    
+    writer.fd = -1;
+    closeBulkWriter(&writer);
+    return NULL;
+}
+
+// Reads every record of [from, to] from the overlapping segments into a
+// new array (free it). Returns the record count, or -1 on failure.
+int readHistoryPeriod(time_t from, time_t to, Transaction **records) {
+    *records = NULL;
+    int segmentCount;
+    pthread_mutex_lock(&logLock);
+    int *selected = selectHistorySegments(from, to, &segmentCount);
+    pthread_mutex_unlock(&logLock);
+    if (selected == NULL) {
+        return -1;
+    }
+    
+    size_t total = 0;
+    for (int segment = 0; segment < segmentCount; segment++) {
+        total += selected[segment];
+    }
+    if (total > INT_MAX) {
+        free(selected);
+        return -1;
+    }
+    *records = malloc((total > 0 ? total : 1) * sizeof(Transaction));
+    if (*records == NULL) {
+        free(selected);
+        return -1;
+    }
+    
+    HistoryReader *reader = malloc(sizeof(HistoryReader));
+    if (reader == NULL) {
+        free(selected);
+        free(*records);
+        *records = NULL;
+        return -1;
+    }
+    int count = 0;
+    for (int segment = 0; segment < segmentCount; segment++) {
+        if (selected[segment] == 0) continue;
+        if (!openHistoryReader(reader, segment)) continue;
+        
+        // Segments straddling the period's edges hold records outside it
+        int remaining = selected[segment];
+        while (remaining-- > 0 && readHistoryRecord(reader, &(*records)[count]) > 0) {
+            if ((*records)[count].timestamp >= from && (*records)[count].timestamp <= to) {
+                count++;
+            }
+        }
+        closeHistoryReader(reader);
+    }
+    free(reader);
+    free(selected);
+    return count;
+}
+
+// Sets prior[p] to the balance after the last record before from of every
+// position p marked in quiet, or to NO_PRIOR_BALANCE if it has none. The
+// segments before from are read newest first, each in one sequential pass,
+// and the scan stops once every quiet account is settled, so quiet
+// accounts cost no index walks of their own. numbers is a snapshot of the
+// account numbers. Returns 0 if the scan could not be set up.
+int readPriorBalances(time_t from, const long long *numbers, const unsigned char *quiet,
+                      int positions, long long *prior) {
+    int unsettled = 0;
+    for (int i = 0; i < positions; i++) {
+        prior[i] = NO_PRIOR_BALANCE;
+        unsettled += quiet[i];
+    }
+    if (unsettled == 0 || from == (time_t)LLONG_MIN) {
+        return 1;
+    }
+    
+    // The quiet accounts get their own small index over the snapshot, so
+    // the scan runs without accountsLock
+    unsigned long long capacity = 16;
+    while (capacity < (unsigned long long)unsettled * 2) {
+        capacity *= 2;
+    }
+    unsigned long long mask = capacity - 1;
+    int *slots = malloc(capacity * sizeof(int));
+    int *found = malloc(unsettled * sizeof(int));
+    unsigned char *settled = calloc(positions, 1);
+    HistoryReader *reader = malloc(sizeof(HistoryReader));
+    if (slots == NULL || found == NULL || settled == NULL || reader == NULL) {
+        free(slots);
+        free(found);
+        free(settled);
+        free(reader);
+        return 0;
+    }
+    for (unsigned long long slot = 0; slot < capacity; slot++) {
+        slots[slot] = INDEX_EMPTY_SLOT;
+    }
+    for (int i = 0; i < positions; i++) {
+        if (!quiet[i]) continue;
+        unsigned long long slot = hashAccountNumber(numbers[i]) & mask;
+        while (slots[slot] != INDEX_EMPTY_SLOT && numbers[slots[slot]] != numbers[i]) {
+            slot = (slot + 1) & mask;
+        }
+        if (slots[slot] == INDEX_EMPTY_SLOT) {
+            slots[slot] = i;
+        } else {
+            unsettled--;          // a duplicate number stays without a statement
+        }
+    }
+    
+    int segmentCount;
+    pthread_mutex_lock(&logLock);
+    int *selected = selectHistorySegments((time_t)LLONG_MIN, from - 1, &segmentCount);
+    pthread_mutex_unlock(&logLock);
+    if (selected == NULL) {
+        segmentCount = 0;
+    }
+    
+    for (int segment = segmentCount - 1; segment >= 0 && unsettled > 0; segment--) {
+        if (selected[segment] == 0) continue;
+        if (!openHistoryReader(reader, segment)) continue;
+        
+        // Records are in append order, so the last one before from wins
+        // within a segment, and a newer segment's wins over older ones
+        int foundCount = 0;
+        int remaining = selected[segment];
+        Transaction trans;
+        while (remaining-- > 0 && readHistoryRecord(reader, &trans) > 0) {
+            if (trans.timestamp >= from) continue;
+            unsigned long long slot = hashAccountNumber(trans.accountNumber) & mask;
+            while (slots[slot] != INDEX_EMPTY_SLOT && numbers[slots[slot]] != trans.accountNumber) {
+                slot = (slot + 1) & mask;
+            }
+            int position = slots[slot];
+            if (position == INDEX_EMPTY_SLOT || settled[position]) continue;
+            if (prior[position] == NO_PRIOR_BALANCE) {
+                found[foundCount++] = position;
+            }
+            prior[position] = trans.balanceAfter;
+        }
+        closeHistoryReader(reader);
+        for (int i = 0; i < foundCount; i++) {
+            settled[found[i]] = 1;
+        }
+        unsettled -= foundCount;
+    }
+    
+    free(selected);
+    free(slots);
+    free(found);
+    free(settled);
+    free(reader);
+    return 1;
+}
+
+// Writes the statements of every account for [from, to] into directory.
+// Returns the number of statements written, or -1 if the run failed;
+// *recordCount receives the number of transactions covered.
+int generateStatements(time_t from, time_t to, const char *directory, int *recordCount) {
+    *recordCount = 0;
+    if (mkdir(directory, 0755) != 0 && errno != EEXIST) {
+        return -1;
+    }
+    
+    Transaction *records;
+    int count = readHistoryPeriod(from, to, &records);
+    if (count < 0) {
+        return -1;
+    }
+    
+    // Snapshot the accounts, then group record indexes by account position
+    pthread_rwlock_rdlock(&accountsLock);
+    int positions = accountCount;
+    int *starts = calloc(positions + 1, sizeof(int));
+    int *order = malloc((count > 0 ? count : 1) * sizeof(int));
+    int *owners = malloc((count > 0 ? count : 1) * sizeof(int));
+    long long *numbers = malloc((positions > 0 ? positions : 1) * sizeof(long long));
+    const char **names = malloc((positions > 0 ? positions : 1) * sizeof(char *));
+    StatementSummary *summaries = calloc(positions > 0 ? positions : 1, sizeof(StatementSummary));
+    int ok = (starts != NULL && order != NULL && owners != NULL && numbers != NULL &&
+              names != NULL && summaries != NULL);
+    // The workers run after the lock is released, so they get copies of
+    // the names, packed into one buffer
+    char *nameText = NULL;
+    if (ok) {
+        size_t nameBytes = 1;
+        for (int i = 0; i < positions; i++) {
+            nameBytes += strlen(accounts[i].fullName) + 1;
+        }
+        nameText = malloc(nameBytes);
+        ok = (nameText != NULL);
+    }
+    if (ok) {
+        memcpy(numbers, accountNumbers, positions * sizeof(long long));
+        char *name = nameText;
+        for (int i = 0; i < positions; i++) {
+            size_t length = strlen(accounts[i].fullName) + 1;
+            memcpy(name, accounts[i].fullName, length);
+            names[i] = name;
+            name += length;
+        }
+        for (int i = 0; i < count; i++) {
+            owners[i] = findAccountIndex(records[i].accountNumber);
+            if (owners[i] >= 0 && owners[i] < positions) {
+                starts[owners[i] + 1]++;
+            }
+        }
+    }
+    pthread_rwlock_unlock(&accountsLock);
+    
+    int written = -1;
+    long long *priorBalances = NULL;
+    if (ok) {
+        for (int i = 0; i < positions; i++) {
+            starts[i + 1] += starts[i];
+        }
+        // Filling advances each start to the next account's start, so
+        // shift them back by one afterwards
+        for (int i = 0; i < count; i++) {
+            if (owners[i] >= 0 && owners[i] < positions) {
+                order[starts[owners[i]]++] = i;
+            }
+        }
+        for (int i = positions; i > 0; i--) {
+            starts[i] = starts[i - 1];
+        }
+        starts[0] = 0;
+        *recordCount = starts[positions];
+        
+        // Accounts quiet in the period open and close on their last
+        // earlier balance, found by one scan of the older history
+        unsigned char *quiet = malloc(positions > 0 ? positions : 1);
+        priorBalances = malloc((positions > 0 ? positions : 1) * sizeof(long long));
+        ok = (quiet != NULL && priorBalances != NULL);
+        if (ok) {
+            for (int i = 0; i < positions; i++) {
+                quiet[i] = (starts[i] == starts[i + 1]);
+            }
+            ok = readPriorBalances(from, numbers, quiet, positions, priorBalances);
+        }
+        free(quiet);
+    }
+    
+    if (ok) {
+        
+        // Slice the accounts so each worker gets a similar share of records
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        int threadCount = (cpus > STATEMENT_MAX_WORKERS) ? STATEMENT_MAX_WORKERS : (cpus < 1 ? 1 : (int)cpus);
+        StatementWorker workers[STATEMENT_MAX_WORKERS];
+        pthread_t threads[STATEMENT_MAX_WORKERS];
+        int started[STATEMENT_MAX_WORKERS];
+        long long work = (long long)starts[positions] + positions;
+        int position = 0;
+        for (int i = 0; i < threadCount; i++) {
+            long long target = work * (i + 1) / threadCount;
+            int end = position;
+            while (end < positions && (long long)starts[end] + end < target) {
+                end++;
+            }
+            if (i == threadCount - 1) end = positions;
+            
+            StatementWorker worker = {records, order, starts, numbers, names, priorBalances, summaries,
+                                      position, end, directory, from, to, 0};
+            workers[i] = worker;
+            started[i] = (i < threadCount - 1 &&
+                          pthread_create(&threads[i], NULL, statementWorkerMain, &workers[i]) == 0);
+            if (!started[i]) {
+                statementWorkerMain(&workers[i]);
+            }
+            position = end;
+        }
+        
+        int failures = 0;
+        for (int i = 0; i < threadCount; i++) {
+            if (started[i]) pthread_join(threads[i], NULL);
+            failures += workers[i].failures;
+        }
+        
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/statements.csv", directory);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        BulkWriter writer;
+        if (fd != -1 && openBulkWriter(&writer, fd)) {
+            written = 0;
+            bulkPrintf(&writer, "account_number,name,opening_balance,credits,debits,closing_balance,transactions\n");
+            char quotedName[2 * MAX_NAME_LENGTH + 3];
+            for (int i = 0; i < positions; i++) {
+                if (!summaries[i].written) continue;
+                quoteCsvField(names[i], quotedName, sizeof(quotedName));
+                bulkPrintf(&writer, "%lld,%s," MONEY_FMT "," MONEY_FMT "," MONEY_FMT "," MONEY_FMT ",%d\n",
+                           numbers[i], quotedName, MONEY_ARGS(summaries[i].openingBalance),
+                           MONEY_ARGS(summaries[i].credits), MONEY_ARGS(summaries[i].debits),
+                           MONEY_ARGS(summaries[i].closingBalance), summaries[i].transactions);
+                written++;
+            }
+            if (!closeBulkWriter(&writer) || failures > 0) {
+                written = -1;
+            }
+        }
+        if (fd != -1) close(fd);
+    }
+    
+    free(records);
+    free(starts);
+    free(order);
+    free(owners);
+    free(numbers);
+    free(names);
+    free(nameText);
+    free(priorBalances);
+    free(summaries);
+    return written;
+}
+
+void displayTransactionRange(long long accNum, time_t from, time_t to, int limit) {
+    Transaction *records;
+    int count = readTransactionRange(accNum, from, to, limit, &records);
+    if (count == -1) {
+        printf("No transaction history found.\n");
+        return;
+    }
+    
+    printf("\n=== TRANSACTION HISTORY ===\n");
+    printf("Account: %lld\n\n", accNum);
+    
+    for (int i = 0; i < count; i++) {
+        printTransaction(&records[i]);
+    }
+    
+    if (count == 0) {
+        printf("No transactions found for this account.\n");
+    }
+    free(records);
+}
+
+void displayTransactionHistory(long long accNum, int limit) {
+    displayTransactionRange(accNum, (time_t)LLONG_MIN, (time_t)LLONG_MAX, limit);
+}
+
+void displayHistoryReport() {
+    time_t from = (time_t)LLONG_MIN;
+    time_t to = (time_t)LLONG_MAX;
+    if (readDateRange(&from, &to) < 0) {
+        return;
+    }
+    
+    HistoryReport report;
+    if (!buildHistoryReport(from, to, &report)) {
+        printf("Error: Could not read the transaction history.\n");
+        return;
+    }
+    
+    printf("\nSegments Read: %d of %d\n", report.segmentsRead, report.segmentCount);
+    printf("Transactions: %lld\n\n", report.records);
+    printf("%-12s %10s %20s\n", "Type", "Count", "Amount");
+    for (int type = 0; type < TRANSACTION_TYPES; type++) {
+        char amount[32];
+        snprintf(amount, sizeof(amount), "K " MONEY_FMT, MONEY_ARGS(report.amounts[type]));
+        printf("%-12s %10lld %20s\n", transactionTypeNames[type], report.counts[type], amount);
+    }
+}
+
+void runStatementJob() {
+    time_t from;
+    time_t to;
+    if (readDateRange(&from, &to) != 1) {
+        printf("A statement period is required.\n");
+        return;
+    }
+    
+    char directory[256];
+    printf("Output directory (Enter for %s): ", STATEMENT_DEFAULT_DIRECTORY);
+    if (fgets(directory, sizeof(directory), stdin) == NULL) {
+        directory[0] = '\0';
+    }
+    directory[strcspn(directory, "\n")] = 0;
+    if (directory[0] == '\0') {
+        strcpy(directory, STATEMENT_DEFAULT_DIRECTORY);
+    }
+    
+    int records;
+    long long startMs = currentTimeMs();
+    int written = generateStatements(from, to, directory, &records);
+    if (written < 0) {
+        printf("Error: Could not write the statements to %s.\n", directory);
+        return;
+    }
+    printf("\nWrote %d statements covering %d transactions to %s/ in %lld ms.\n",
+           written, records, directory, currentTimeMs() - startMs);
+}
+
+// Core operations
+// These hold the banking rules shared by the interactive menus and batch
+// mode. They never prompt, clear the screen or pause.
+const char *bankStatusName(BankStatus status) {
+    switch (status) {
+        case BANK_OK: return "OK";
+        case BANK_ERR_NOT_FOUND: return "NOT_FOUND";
+        case BANK_ERR_RECIPIENT_NOT_FOUND: return "RECIPIENT_NOT_FOUND";
+        case BANK_ERR_SAME_ACCOUNT: return "SAME_ACCOUNT";
+        case BANK_ERR_INVALID_AMOUNT: return "INVALID_AMOUNT";
+        case BANK_ERR_INSUFFICIENT_FUNDS: return "INSUFFICIENT_FUNDS";
+        case BANK_ERR_WRONG_PASSWORD: return "WRONG_PASSWORD";
+        case BANK_ERR_INVALID_PASSWORD: return "INVALID_PASSWORD";
+        case BANK_ERR_INVALID_NAME: return "INVALID_NAME";
+        case BANK_ERR_MINIMUM_DEPOSIT: return "MINIMUM_DEPOSIT";
+        case BANK_ERR_STORAGE: return "STORAGE";
+        case BANK_ERR_ABORTED: return "ABORTED";
+    }
+    return "UNKNOWN";
+}
+
+BankStatus performRegistration(const char *name, const char *password, long long initialDeposit, long long *accNum) {
+    if (strlen(name) >= MAX_NAME_LENGTH || !validateName(name)) return BANK_ERR_INVALID_NAME;
+    if (strlen(password) >= MAX_PASSWORD_LENGTH || !validatePassword(password)) return BANK_ERR_INVALID_PASSWORD;
+    if (initialDeposit < MINIMUM_OPENING_DEPOSIT) return BANK_ERR_MINIMUM_DEPOSIT;
+    
+    AccountRecord newAccount;
+    memset(&newAccount, 0, sizeof(AccountRecord));
+    strcpy(newAccount.fullName, name);
+    if (!hashPassword(password, newAccount.password)) return BANK_ERR_STORAGE;
+    
+    newAccount.accountNumber = allocateAccountNumber();
+    if (newAccount.accountNumber == -1) {
+        printf("Error: No account numbers left.\n");
+        return BANK_ERR_STORAGE;
+    }
+    newAccount.balance = initialDeposit;
+    newAccount.isActive = 1;
+    
+    int position = addAccount(&newAccount);
+    if (position == -1) return BANK_ERR_STORAGE;
+    
+    BankStatus status = BANK_OK;
+    long long ticket = 0;
+    pthread_rwlock_rdlock(&accountsLock);
+    lockAccount(position);
+    pthread_mutex_lock(&logLock);
+    if (logAccountChanges(&position, 1)) {
+        ticket = saveTransaction(newAccount.accountNumber, TRANSACTION_OPENING, newAccount.balance, newAccount.balance, 0);
+    } else {
+        // The slot cannot be taken back; leave it closed and empty
+        accountBalances[position] = 0;
+        accountActive[position] = 0;
+        updateAccountStatistics(position, 0, 0);
+        markShardsDirty(&position, 1);
+        status = BANK_ERR_STORAGE;
+    }
+    pthread_mutex_unlock(&logLock);
+    unlockAccount(position);
+    pthread_rwlock_unlock(&accountsLock);
+    if (status == BANK_OK) {
+        // An account whose commit failed stays open, so report its number
+        *accNum = newAccount.accountNumber;
+        if (!awaitCommit(ticket)) status = BANK_ERR_STORAGE;
+    }
+    runPendingCheckpoint();
+    return status;
+}
+
+// Copies into stored the password hash of the first account numbered
+// accNum above position after (and active, when activeOnly is set).
+// Returns its position, or -1 if there is none. Accounts never move, so
+// the position stays valid.
+int copyPasswordHash(long long accNum, int after, int activeOnly, char *stored) {
+    pthread_rwlock_rdlock(&accountsLock);
+    int accountIndex = findNextAccountIndex(accNum, after);
+    while (activeOnly && accountIndex != -1 && !accountActive[accountIndex]) {
+        accountIndex = findNextAccountIndex(accNum, accountIndex);
+    }
+    if (accountIndex != -1) {
+        lockAccount(accountIndex);
+        memcpy(stored, accounts[accountIndex].password, MAX_PASSWORD_LENGTH);
+        unlockAccount(accountIndex);
+    }
+    pthread_rwlock_unlock(&accountsLock);
+    return accountIndex;
+}
+
+// Stores newHash for the account at position if its hash is still
+// expected, i.e. nobody changed the password while the caller was hashing.
+// Returns BANK_ERR_WRONG_PASSWORD if somebody did.
+BankStatus replacePasswordHash(int position, const char *expected, const char *newHash) {
+    BankStatus status = BANK_ERR_WRONG_PASSWORD;
+    long long ticket = 0;
+    pthread_rwlock_rdlock(&accountsLock);
+    lockAccount(position);
+    if (memcmp(accounts[position].password, expected, MAX_PASSWORD_LENGTH) == 0) {
+        memcpy(accounts[position].password, newHash, MAX_PASSWORD_LENGTH);
+        pthread_mutex_lock(&logLock);
+        if (logAccountChanges(&position, 1)) {
+            ticket = commitOperation();
+            status = BANK_OK;
+        } else {
+            memcpy(accounts[position].password, expected, MAX_PASSWORD_LENGTH);
+            status = BANK_ERR_STORAGE;
+        }
+        pthread_mutex_unlock(&logLock);
+    }
+    unlockAccount(position);
+    pthread_rwlock_unlock(&accountsLock);
+    if (!awaitCommit(ticket)) status = BANK_ERR_STORAGE;
+    runPendingCheckpoint();
+    return status;
+}
+
+// Checks credentials; on success *position is the account's slot. The
+// hash is checked without holding any lock, since it is slow on purpose.
+// An old or cheaper hash is replaced with one at the current cost.
+BankStatus performLogin(long long accNum, const char *password, int *position) {
+    char stored[MAX_PASSWORD_LENGTH];
+    int accountIndex = copyPasswordHash(accNum, -1, 1, stored);
+    if (accountIndex == -1) return BANK_ERR_NOT_FOUND;
+    // Every active account with the number is tried, duplicates included
+    while (!verifyPassword(password, stored)) {
+        accountIndex = copyPasswordHash(accNum, accountIndex, 1, stored);
+        if (accountIndex == -1) return BANK_ERR_WRONG_PASSWORD;
+    }
+    
+    char upgraded[MAX_PASSWORD_LENGTH];
+    if (passwordNeedsRehash(stored) && hashPassword(password, upgraded)) {
+        replacePasswordHash(accountIndex, stored, upgraded);
+    }
+    *position = accountIndex;
+    return BANK_OK;
+}
+
+BankStatus performDeposit(long long accNum, long long amount) {
+    BankStatus status = BANK_OK;
+    long long ticket = 0;
+    pthread_rwlock_rdlock(&accountsLock);
+    int accountIndex = findAccountIndex(accNum);
+    if (accountIndex == -1) {
+        status = BANK_ERR_NOT_FOUND;
+    } else if (amount <= 0) {
+        status = BANK_ERR_INVALID_AMOUNT;
+    } else {
+        lockAccount(accountIndex);
+        preserveAccount(accountIndex);
+        accountBalances[accountIndex] += amount;
+        pthread_mutex_lock(&logLock);
+        if (logAccountChanges(&accountIndex, 1)) {
+            ticket = saveTransaction(accNum, TRANSACTION_DEPOSIT, amount, accountBalances[accountIndex], 0);
+            recordDailyVolume(VOLUME_DEPOSIT, amount);
+        } else {
+            accountBalances[accountIndex] -= amount;
+            status = BANK_ERR_STORAGE;
+        }
+        pthread_mutex_unlock(&logLock);
+        updateAccountStatistics(accountIndex, accountBalances[accountIndex], accountActive[accountIndex]);
+        unlockAccount(accountIndex);
+    }
+    pthread_rwlock_unlock(&accountsLock);
+    if (!awaitCommit(ticket)) status = BANK_ERR_STORAGE;
+    runPendingCheckpoint();
+    return status;
+}
+
+BankStatus performWithdrawal(long long accNum, long long amount) {
+    BankStatus status = BANK_OK;
+    long long ticket = 0;
+    pthread_rwlock_rdlock(&accountsLock);
+    int accountIndex = findAccountIndex(accNum);
+    if (accountIndex == -1) {
+        status = BANK_ERR_NOT_FOUND;
+    } else if (amount <= 0) {
+        status = BANK_ERR_INVALID_AMOUNT;
+    } else {
+        lockAccount(accountIndex);
+        if (amount > accountBalances[accountIndex]) {
+            status = BANK_ERR_INSUFFICIENT_FUNDS;
+        } else {
+            preserveAccount(accountIndex);
+            accountBalances[accountIndex] -= amount;
+            pthread_mutex_lock(&logLock);
+            if (logAccountChanges(&accountIndex, 1)) {
+                ticket = saveTransaction(accNum, TRANSACTION_WITHDRAWAL, -amount, accountBalances[accountIndex], 0);
+                recordDailyVolume(VOLUME_WITHDRAWAL, amount);
+            } else {
+                accountBalances[accountIndex] += amount;
+                status = BANK_ERR_STORAGE;
+            }
+            pthread_mutex_unlock(&logLock);
+            updateAccountStatistics(accountIndex, accountBalances[accountIndex], accountActive[accountIndex]);
+        }
+        unlockAccount(accountIndex);
+    }
+    pthread_rwlock_unlock(&accountsLock);
+    if (!awaitCommit(ticket)) status = BANK_ERR_STORAGE;
+    runPendingCheckpoint();
+    return status;
+}
+
+BankStatus performTransfer(long long fromAcc, long long toAcc, long long amount) {
+    BankStatus status = BANK_OK;
+    long long ticket = 0;
+    pthread_rwlock_rdlock(&accountsLock);
+    int fromIndex = findAccountIndex(fromAcc);
+    int toIndex = findAccountIndex(toAcc);
+    if (fromIndex == -1) {
+        status = BANK_ERR_NOT_FOUND;
+    } else if (toAcc == fromAcc) {
+        status = BANK_ERR_SAME_ACCOUNT;
+    } else if (toIndex == -1 || !accountActive[toIndex]) {
+        status = BANK_ERR_RECIPIENT_NOT_FOUND;
+    } else if (amount <= 0) {
+        status = BANK_ERR_INVALID_AMOUNT;
+    } else {
+        lockAccountPair(fromIndex, toIndex);
+        if (amount > accountBalances[fromIndex]) {
+            status = BANK_ERR_INSUFFICIENT_FUNDS;
+        } else {
+            int changed[2] = {fromIndex, toIndex};
+            preserveAccount(fromIndex);
+            preserveAccount(toIndex);
+            accountBalances[fromIndex] -= amount;
+            accountBalances[toIndex] += amount;
+            pthread_mutex_lock(&logLock);
+            if (logAccountChanges(changed, 2)) {
+                // Save transactions for both accounts
+                appendTransaction(fromAcc, TRANSACTION_TRANSFER, -amount, accountBalances[fromIndex], toAcc);
+                appendTransaction(toAcc, TRANSACTION_TRANSFER, amount, accountBalances[toIndex], fromAcc);
+                ticket = commitOperation();
+                recordDailyVolume(VOLUME_TRANSFER, amount);
+            } else {
+                accountBalances[fromIndex] += amount;
+                accountBalances[toIndex] -= amount;
+                status = BANK_ERR_STORAGE;
+            }
+            pthread_mutex_unlock(&logLock);
+            updateChangedStatistics(changed, 2);
+        }
+        unlockAccountPair(fromIndex, toIndex);
+    }
+    pthread_rwlock_unlock(&accountsLock);
+    if (!awaitCommit(ticket)) status = BANK_ERR_STORAGE;
+    runPendingCheckpoint();
+    return status;
+}
+
+int comparePositions(const void *a, const void *b) {
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Restores the balances the applied rows changed, newest first so every
+// balance returns to where it started, and marks those rows with status.
+void undoBulkTransfers(BulkTransfer *transfers, int count, BankStatus status) {
+    for (int i = count - 1; i >= 0; i--) {
+        if (transfers[i].status != BANK_OK) continue;
+        accountBalances[findAccountIndex(transfers[i].fromAccount)] += transfers[i].amount;
+        accountBalances[findAccountIndex(transfers[i].toAccount)] -= transfers[i].amount;
+        transfers[i].status = status;
+    }
+}
+
+// Applies the transfers in order as one operation: every account is
+// locked for the whole batch, so each row is checked against the balances
+// left by the rows before it, and one log write and one commit cover all
+// of them. With allOrNothing, a single failed row rolls the batch back and
+// the valid rows are marked BANK_ERR_ABORTED; otherwise failed rows are
+// skipped. Returns the number of rows applied.
+int performBulkTransfer(BulkTransfer *transfers, int count, int allOrNothing) {
+    int *changed = malloc((2 * count + 1) * sizeof(int));
+    if (changed == NULL) {
+        for (int i = 0; i < count; i++) transfers[i].status = BANK_ERR_STORAGE;
+        return 0;
+    }
+    
+    int applied = 0;
+    int failed = 0;
+    long long ticket = 0;
+    pthread_rwlock_rdlock(&accountsLock);
+    lockAllAccounts();
+    for (int i = 0; i < count; i++) {
+        BulkTransfer *row = &transfers[i];
+        int fromIndex = findAccountIndex(row->fromAccount);
+        int toIndex = findAccountIndex(row->toAccount);
+        if (fromIndex == -1) {
+            row->status = BANK_ERR_NOT_FOUND;
+        } else if (row->toAccount == row->fromAccount) {
+            row->status = BANK_ERR_SAME_ACCOUNT;
+        } else if (toIndex == -1 || !accountActive[toIndex]) {
+            row->status = BANK_ERR_RECIPIENT_NOT_FOUND;
+        } else if (row->amount <= 0) {
+            row->status = BANK_ERR_INVALID_AMOUNT;
+        } else if (row->amount > accountBalances[fromIndex]) {
+            row->status = BANK_ERR_INSUFFICIENT_FUNDS;
+        } else {
+            row->status = BANK_OK;
+            preserveAccount(fromIndex);
+            preserveAccount(toIndex);
+            accountBalances[fromIndex] -= row->amount;
+            accountBalances[toIndex] += row->amount;
+            row->fromBalance = accountBalances[fromIndex];
+            row->toBalance = accountBalances[toIndex];
+            changed[2 * applied] = fromIndex;
+            changed[2 * applied + 1] = toIndex;
+            applied++;
+            continue;
+        }
+        failed++;
+    }
+    
+    if (allOrNothing && failed > 0) {
+        undoBulkTransfers(transfers, count, BANK_ERR_ABORTED);
+        applied = 0;
+    }
+    
+    if (applied > 0) {
+        int changedCount = 0;
+        qsort(changed, 2 * applied, sizeof(int), comparePositions);
+        for (int i = 0; i < 2 * applied; i++) {
+            if (changedCount == 0 || changed[changedCount - 1] != changed[i]) {
+                changed[changedCount++] = changed[i];
+            }
+        }
+        
+        pthread_mutex_lock(&logLock);
+        int logged;
+        if (changedCount <= WAL_MAX_BATCH) {
+            logged = logAccountChanges(changed, changedCount);
+        } else if (walFile == NULL) {
+            // Refused like any change while there is no log
+            abandonWriteAheadLog();
+            logged = 0;
+        } else {
+            // Too many accounts for one log batch. Every stripe is held,
+            // so no operation is half applied and one checkpoint can
+            // record the whole batch.
+            markShardsDirty(changed, changedCount);
+            logged = checkpoint();
+            if (!logged) {
+                // Some shards may hold the batch already; take no changes
+                // until a checkpoint has rewritten them without it
+                abandonWriteAheadLog();
+            }
+        }
+        if (!logged) {
+            undoBulkTransfers(transfers, count, BANK_ERR_STORAGE);
+            markShardsDirty(changed, changedCount);
+            applied = 0;
+        }
+        updateChangedStatistics(changed, changedCount);
+        for (int i = 0; i < count; i++) {
+            BulkTransfer *row = &transfers[i];
+            if (row->status != BANK_OK) continue;
+            recordDailyVolume(VOLUME_TRANSFER, row->amount);
+            appendTransaction(row->fromAccount, TRANSACTION_TRANSFER, -row->amount, row->fromBalance, row->toAccount);
+            appendTransaction(row->toAccount, TRANSACTION_TRANSFER, row->amount, row->toBalance, row->fromAccount);
+        }
+        ticket = commitOperation();
+        pthread_mutex_unlock(&logLock);
+    }
+    unlockAllAccounts();
+    pthread_rwlock_unlock(&accountsLock);
+    free(changed);
+    if (!awaitCommit(ticket)) {
+        for (int i = 0; i < count; i++) {
+            if (transfers[i].status == BANK_OK) transfers[i].status = BANK_ERR_STORAGE;
+        }
+        applied = 0;
+    }
+    runPendingCheckpoint();
+    return applied;
+}
+
+BankStatus performPasswordChange(long long accNum, const char *currentPassword, const char *newPassword) {
+    char stored[MAX_PASSWORD_LENGTH];
+    int accountIndex = copyPasswordHash(accNum, -1, 0, stored);
+    if (accountIndex == -1) return BANK_ERR_NOT_FOUND;
+    if (!verifyPassword(currentPassword, stored)) return BANK_ERR_WRONG_PASSWORD;
+    if (!validatePassword(newPassword) || strlen(newPassword) >= MAX_PASSWORD_LENGTH) {
+        return BANK_ERR_INVALID_PASSWORD;
+    }
+    
+    char newHash[MAX_PASSWORD_LENGTH];
+    if (!hashPassword(newPassword, newHash)) return BANK_ERR_STORAGE;
+    // A concurrent change means currentPassword is no longer current
+    return replacePasswordHash(accountIndex, stored, newHash);
+}
+
+// Login pool
+// Password checks dominate the cost of a login, so a burst of logins
+// (consecutive login lines in batch mode, or the login benchmark) is
+// spread over a pool of threads. The submitting thread takes part too.
+typedef struct {
+    long long accountNumber;
+    char password[MAX_PASSWORD_LENGTH];
+    int position;
+    BankStatus status;
+} LoginRequest;
+
+pthread_mutex_t loginSubmitLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t loginPoolLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t loginWorkAvailable = PTHREAD_COND_INITIALIZER;
+pthread_cond_t loginWorkFinished = PTHREAD_COND_INITIALIZER;
+pthread_t *loginWorkers = NULL;
+int loginWorkerCount = 0;      // threads in the pool including the submitter; 0 means one per CPU
+int loginWorkersStarted = 0;
+int loginPoolShutdown = 0;
+LoginRequest *loginQueue = NULL;
+int loginQueueSize = 0;
+int loginQueueNext = 0;
+int loginQueueUnfinished = 0;
+
+// Runs requests of the current burst until none are left to take.
+// Called and returns with loginPoolLock held.
+void drainLoginQueue() {
+    while (loginQueueNext < loginQueueSize) {
+        LoginRequest *request = &loginQueue[loginQueueNext++];
+        pthread_mutex_unlock(&loginPoolLock);
+        request->status = performLogin(request->accountNumber, request->password, &request->position);
+        pthread_mutex_lock(&loginPoolLock);
+        if (--loginQueueUnfinished == 0) {
+            pthread_cond_broadcast(&loginWorkFinished);
+        }
+    }
+}
+
+void *loginWorkerMain(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&loginPoolLock);
+    while (!loginPoolShutdown) {
+        drainLoginQueue();
+        pthread_cond_wait(&loginWorkAvailable, &loginPoolLock);
+    }
+    pthread_mutex_unlock(&loginPoolLock);
+    return NULL;
+}
+
+// Starts the helper threads on first use. Called with loginSubmitLock held.
+void startLoginPool() {
+    if (loginWorkerCount < 1) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        loginWorkerCount = (cpus > 0) ? (int)cpus : 1;
+    }
+    loginWorkersStarted = 1;
+    loginWorkers = calloc(loginWorkerCount, sizeof(pthread_t));
+    if (loginWorkers == NULL) {
+        loginWorkerCount = 1;
+        return;
+    }
+    for (int i = 1; i < loginWorkerCount; i++) {
+        if (pthread_create(&loginWorkers[i], NULL, loginWorkerMain, NULL) != 0) {
+            loginWorkerCount = i;
+            break;
+        }
+    }
+}
+
+void stopLoginPool() {
+    pthread_mutex_lock(&loginSubmitLock);
+    if (loginWorkersStarted) {
+        pthread_mutex_lock(&loginPoolLock);
+        loginPoolShutdown = 1;
+        pthread_cond_broadcast(&loginWorkAvailable);
+        pthread_mutex_unlock(&loginPoolLock);
+        for (int i = 1; i < loginWorkerCount; i++) {
+            pthread_join(loginWorkers[i], NULL);
+        }
+        free(loginWorkers);
+        loginWorkers = NULL;
+        loginWorkersStarted = 0;
+        loginPoolShutdown = 0;
+    }
+    pthread_mutex_unlock(&loginSubmitLock);
+}
+
+// Runs performLogin for every request and waits until all are done.
+// Each request's status and position are filled in.
+void performLogins(LoginRequest *requests, int count) {
+    pthread_mutex_lock(&loginSubmitLock);
+    if (!loginWorkersStarted) {
+        startLoginPool();
+    }
+    pthread_mutex_lock(&loginPoolLock);
+    loginQueue = requests;
+    loginQueueSize = count;
+    loginQueueNext = 0;
+    loginQueueUnfinished = count;
+    pthread_cond_broadcast(&loginWorkAvailable);
+    drainLoginQueue();
+    while (loginQueueUnfinished > 0) {
+        pthread_cond_wait(&loginWorkFinished, &loginPoolLock);
+    }
+    loginQueue = NULL;
+    loginQueueSize = 0;
+    loginQueueNext = 0;
+    pthread_mutex_unlock(&loginPoolLock);
+    pthread_mutex_unlock(&loginSubmitLock);
+}
+
+// Core banking functions
+void userRegistration() {
+    clearScreen();
+    printf("=== MISHTERIOUS BANK - ACCOUNT REGISTRATION ===\n\n");
+    
+    char fullName[MAX_NAME_LENGTH];
+    long long accountNumber = -1;
+    
+    // Get full name
+    do {
+        printf("Enter Full Name: ");
+        fgets(fullName, MAX_NAME_LENGTH, stdin);
+        fullName[strcspn(fullName, "\n")] = 0;
+        
+        if (!validateName(fullName)) {
+            printf("Error: Invalid name. Use only letters, spaces, and dots.\n");
+        }
+    } while (!validateName(fullName));
     
     // Get password
     char password[MAX_PASSWORD_LENGTH];
@@ -297,32 +5793,34 @@ void userRegistration() {
         }
     } while (strcmp(password, confirmPassword) != 0 || !validatePassword(password));
     
-    // Encrypt and store password
-    strcpy(newAccount.password, password);
-    encryptPassword(newAccount.password);
-    
     // Get initial deposit
+    long long deposit;
     do {
         printf("Enter Initial Deposit (K): ");
-        scanf("%lf", &newAccount.balance);
-        clearInputBuffer();
+        deposit = readMoney();
         
-        if (newAccount.balance < 100) {
+        if (deposit < MINIMUM_OPENING_DEPOSIT) {
             printf("Error: Minimum initial deposit is K 100.00\n");
         }
-    } while (newAccount.balance < 100);
+    } while (deposit < MINIMUM_OPENING_DEPOSIT);
     
-    newAccount.isActive = 1;
-    addAccount(newAccount);
-    saveDataToFile();
+    BankStatus status = performRegistration(fullName, password, deposit, &accountNumber);
+    if (status == BANK_ERR_STORAGE && accountNumber != -1) {
+        printf("Error: Account %lld was opened but could not be saved to disk.\n", accountNumber);
+        pauseScreen();
+        return;
+    }
+    if (status != BANK_OK) {
+        printf("Error: Could not create account.\n");
+        pauseScreen();
+        return;
+    }
     
     printf("\n✅ ACCOUNT CREATED SUCCESSFULLY!\n");
-    printf("Account Number: %lld\n", newAccount.accountNumber);
-    printf("Account Holder: %s\n", newAccount.fullName);
-    printf("Initial Balance: K %.2f\n", newAccount.balance);
+    printf("Account Number: %lld\n", accountNumber);
+    printf("Account Holder: %s\n", fullName);
+    printf("Initial Balance: K " MONEY_FMT "\n", MONEY_ARGS(deposit));
     printf("\nPlease save your account number for future login.\n");
-    
-    saveTransaction(newAccount.accountNumber, "OPENING", newAccount.balance, newAccount.balance, 0);
     pauseScreen();
 }
 
@@ -341,16 +5839,13 @@ int userLogin() {
     fgets(password, MAX_PASSWORD_LENGTH, stdin);
     password[strcspn(password, "\n")] = 0;
     
-    for (int i = 0; i < accountCount; i++) {
-        if (accounts[i].accountNumber == accountNumber && accounts[i].isActive) {
-            if (verifyPassword(password, accounts[i].password)) {
-                currentUserAccount = accountNumber;
-                printf("\n✅ LOGIN SUCCESSFUL!\n");
-                printf("Welcome back, %s!\n", accounts[i].fullName);
-                pauseScreen();
-                return 1;
-            }
-        }
+    int accountIndex;
+    if (performLogin(accountNumber, password, &accountIndex) == BANK_OK) {
+        currentUserAccount = accountNumber;
+        printf("\n✅ LOGIN SUCCESSFUL!\n");
+        printf("Welcome back, %s!\n", accounts[accountIndex].fullName);
+        pauseScreen();
+        return 1;
     }
     
     printf("\n❌ LOGIN FAILED! Invalid account number or password.\n");
@@ -358,17 +5853,37 @@ int userLogin() {
     return 0;
 }
 
+// Explains why a deposit, withdrawal or transfer was refused. operation
+// names it ("Deposit", ...); balance is the account's balance afterwards.
+void printTransactionError(BankStatus status, const char *operation, long long balance) {
+    switch (status) {
+        case BANK_ERR_INVALID_AMOUNT:
+            printf("Error: %s amount must be positive.\n", operation);
+            break;
+        case BANK_ERR_INSUFFICIENT_FUNDS:
+            printf("Error: Insufficient funds. Available balance: K " MONEY_FMT "\n", MONEY_ARGS(balance));
+            break;
+        case BANK_ERR_NOT_FOUND:
+            printf("Error: Account not found.\n");
+            break;
+        case BANK_ERR_RECIPIENT_NOT_FOUND:
+            printf("Error: Recipient account not found or inactive.\n");
+            break;
+        case BANK_ERR_STORAGE:
+            printf("Error: %s could not be saved to disk. Check your balance before trying again.\n", operation);
+            break;
+        default:
+            printf("Error: %s failed (%s).\n", operation, bankStatusName(status));
+            break;
+    }
+    pauseScreen();
+}
+
 void depositFunds() {
     clearScreen();
     printf("=== MISHTERIOUS BANK - DEPOSIT FUNDS ===\n\n");
     
-    int accountIndex = -1;
-    for (int i = 0; i < accountCount; i++) {
-        if (accounts[i].accountNumber == currentUserAccount) {
-            accountIndex = i;
-            break;
-        }
-    }
+    int accountIndex = findAccountIndex(currentUserAccount);
     
     if (accountIndex == -1) {
         printf("Error: Account not found.\n");
@@ -376,25 +5891,19 @@ void depositFunds() {
         return;
     }
     
-    double amount;
-    printf("Current Balance: K %.2f\n", accounts[accountIndex].balance);
+    printf("Current Balance: K " MONEY_FMT "\n", MONEY_ARGS(accountBalances[accountIndex]));
     printf("Enter amount to deposit (K): ");
-    scanf("%lf", &amount);
-    clearInputBuffer();
+    long long amount = readMoney();
     
-    if (amount <= 0) {
-        printf("Error: Deposit amount must be positive.\n");
-        pauseScreen();
+    BankStatus status = performDeposit(currentUserAccount, amount);
+    if (status != BANK_OK) {
+        printTransactionError(status, "Deposit", accountBalances[accountIndex]);
         return;
     }
     
-    accounts[accountIndex].balance += amount;
-    saveDataToFile();
-    saveTransaction(currentUserAccount, "DEPOSIT", amount, accounts[accountIndex].balance, 0);
-    
     printf("\n✅ DEPOSIT SUCCESSFUL!\n");
-    printf("Amount Deposited: K %.2f\n", amount);
-    printf("New Balance: K %.2f\n", accounts[accountIndex].balance);
+    printf("Amount Deposited: K " MONEY_FMT "\n", MONEY_ARGS(amount));
+    printf("New Balance: K " MONEY_FMT "\n", MONEY_ARGS(accountBalances[accountIndex]));
     pauseScreen();
 }
 
@@ -402,13 +5911,7 @@ void withdrawFunds() {
     clearScreen();
     printf("=== MISHTERIOUS BANK - WITHDRAW FUNDS ===\n\n");
     
-    int accountIndex = -1;
-    for (int i = 0; i < accountCount; i++) {
-        if (accounts[i].accountNumber == currentUserAccount) {
-            accountIndex = i;
-            break;
-        }
-    }
+    int accountIndex = findAccountIndex(currentUserAccount);
     
     if (accountIndex == -1) {
         printf("Error: Account not found.\n");
@@ -416,31 +5919,19 @@ void withdrawFunds() {
         return;
     }
     
-    double amount;
-    printf("Current Balance: K %.2f\n", accounts[accountIndex].balance);
+    printf("Current Balance: K " MONEY_FMT "\n", MONEY_ARGS(accountBalances[accountIndex]));
     printf("Enter amount to withdraw (K): ");
-    scanf("%lf", &amount);
-    clearInputBuffer();
-    
-    if (amount <= 0) {
-        printf("Error: Withdrawal amount must be positive.\n");
-        pauseScreen();
-        return;
-    }
+    long long amount = readMoney();
     
-    if (amount > accounts[accountIndex].balance) {
-        printf("Error: Insufficient funds. Available balance: K %.2f\n", accounts[accountIndex].balance);
-        pauseScreen();
+    BankStatus status = performWithdrawal(currentUserAccount, amount);
+    if (status != BANK_OK) {
+        printTransactionError(status, "Withdrawal", accountBalances[accountIndex]);
         return;
     }
     
-    accounts[accountIndex].balance -= amount;
-    saveDataToFile();
-    saveTransaction(currentUserAccount, "WITHDRAWAL", -amount, accounts[accountIndex].balance, 0);
-    
     printf("\n✅ WITHDRAWAL SUCCESSFUL!\n");
-    printf("Amount Withdrawn: K %.2f\n", amount);
-    printf("New Balance: K %.2f\n", accounts[accountIndex].balance);
+    printf("Amount Withdrawn: K " MONEY_FMT "\n", MONEY_ARGS(amount));
+    printf("New Balance: K " MONEY_FMT "\n", MONEY_ARGS(accountBalances[accountIndex]));
     pauseScreen();
 }
 
@@ -448,13 +5939,7 @@ void transferFunds() {
     clearScreen();
     printf("=== MISHTERIOUS BANK - TRANSFER FUNDS ===\n\n");
     
-    int fromIndex = -1;
-    for (int i = 0; i < accountCount; i++) {
-        if (accounts[i].accountNumber == currentUserAccount) {
-            fromIndex = i;
-            break;
-        }
-    }
+    int fromIndex = findAccountIndex(currentUserAccount);
     
     if (fromIndex == -1) {
         printf("Error: Your account not found.\n");
@@ -463,7 +5948,7 @@ void transferFunds() {
     }
     
     long long toAccountNumber;
-    printf("Your Current Balance: K %.2f\n", accounts[fromIndex].balance);
+    printf("Your Current Balance: K " MONEY_FMT "\n", MONEY_ARGS(accountBalances[fromIndex]));
     printf("Enter recipient account number: ");
     scanf("%lld", &toAccountNumber);
     clearInputBuffer();
@@ -474,65 +5959,148 @@ void transferFunds() {
         return;
     }
     
-    int toIndex = -1;
-    for (int i = 0; i < accountCount; i++) {
-        if (accounts[i].accountNumber == toAccountNumber && accounts[i].isActive) {
-            toIndex = i;
-            break;
-        }
-    }
+    int toIndex = findAccountIndex(toAccountNumber);
     
-    if (toIndex == -1) {
+    if (toIndex == -1 || !accountActive[toIndex]) {
         printf("Error: Recipient account not found or inactive.\n");
         pauseScreen();
         return;
     }
     
-    double amount;
     printf("Enter transfer amount (K): ");
-    scanf("%lf", &amount);
-    clearInputBuffer();
-    
-    if (amount <= 0) {
-        printf("Error: Transfer amount must be positive.\n");
-        pauseScreen();
-        return;
-    }
+    long long amount = readMoney();
     
-    if (amount > accounts[fromIndex].balance) {
-        printf("Error: Insufficient funds. Available balance: K %.2f\n", accounts[fromIndex].balance);
-        pauseScreen();
+    BankStatus status = performTransfer(currentUserAccount, toAccountNumber, amount);
+    if (status != BANK_OK) {
+        printTransactionError(status, "Transfer", accountBalances[fromIndex]);
         return;
     }
     
-    // Perform transfer
-    accounts[fromIndex].balance -= amount;
-    accounts[toIndex].balance += amount;
-    saveDataToFile();
-    
-    // Save transactions for both accounts
-    saveTransaction(currentUserAccount, "TRANSFER", -amount, accounts[fromIndex].balance, toAccountNumber);
-    saveTransaction(toAccountNumber, "TRANSFER", amount, accounts[toIndex].balance, currentUserAccount);
-    
     printf("\n✅ TRANSFER SUCCESSFUL!\n");
-    printf("Amount Transferred: K %.2f\n", amount);
+    printf("Amount Transferred: K " MONEY_FMT "\n", MONEY_ARGS(amount));
     printf("From: %lld (%s)\n", currentUserAccount, accounts[fromIndex].fullName);
     printf("To: %lld (%s)\n", toAccountNumber, accounts[toIndex].fullName);
-    printf("Your New Balance: K %.2f\n", accounts[fromIndex].balance);
+    printf("Your New Balance: K " MONEY_FMT "\n", MONEY_ARGS(accountBalances[fromIndex]));
     pauseScreen();
 }
 
-void changePassword() {
-    clearScreen();
-    printf("=== MISHTERIOUS BANK - CHANGE PASSWORD ===\n\n");
+// Reads a bulk transfer file: one "<from> <to> <amount>" row per line,
+// fields separated by spaces or commas, amounts in kwacha. Blank lines and
+// lines starting with # are skipped. Returns the number of rows in a new
+// array (free it), or -1 after reporting the first bad line.
+int loadBulkTransfers(const char *path, BulkTransfer **transfers) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        printf("Error: Could not open %s.\n", path);
+        return -1;
+    }
     
-    int accountIndex = -1;
-    for (int i = 0; i < accountCount; i++) {
-        if (accounts[i].accountNumber == currentUserAccount) {
-            accountIndex = i;
+    int count = 0;
+    int capacity = 0;
+    BulkTransfer *rows = NULL;
+    char line[256];
+    char amountText[32];
+    int lineNumber = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        lineNumber++;
+        line[strcspn(line, "\r\n")] = 0;
+        for (char *c = line; *c != '\0'; c++) {
+            if (*c == ',') *c = ' ';
+        }
+        char first[2];
+        if (sscanf(line, "%1s", first) != 1 || first[0] == '#') {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = (capacity == 0) ? 1024 : capacity * 2;
+            BulkTransfer *grown = realloc(rows, capacity * sizeof(BulkTransfer));
+            if (grown == NULL) {
+                printf("Error: Memory allocation failed.\n");
+                break;
+            }
+            rows = grown;
+        }
+        BulkTransfer *row = &rows[count];
+        memset(row, 0, sizeof(BulkTransfer));
+        row->line = lineNumber;
+        if (sscanf(line, "%lld %lld %31s", &row->fromAccount, &row->toAccount, amountText) != 3 ||
+            !parseMoney(amountText, &row->amount)) {
+            printf("Error: %s line %d: expected <from> <to> <amount>.\n", path, lineNumber);
             break;
         }
+        count++;
+    }
+    int complete = feof(file);
+    fclose(file);
+    if (!complete) {
+        free(rows);
+        return -1;
+    }
+    *transfers = rows;
+    return count;
+}
+
+// Admin view: runs a payroll-style file of transfers
+void runBulkTransferJob() {
+    char path[PATH_MAX];
+    printf("Transfer file: ");
+    if (fgets(path, sizeof(path), stdin) == NULL) return;
+    path[strcspn(path, "\n")] = 0;
+    
+    BulkTransfer *transfers = NULL;
+    int count = loadBulkTransfers(path, &transfers);
+    if (count < 0) return;
+    if (count == 0) {
+        printf("The file has no transfers.\n");
+        free(transfers);
+        return;
+    }
+    
+    int mode;
+    printf("%d transfers read.\n", count);
+    printf("1. All or nothing  2. Apply the valid rows\n");
+    printf("Enter your choice: ");
+    scanf("%d", &mode);
+    clearInputBuffer();
+    if (mode < 1 || mode > 2) {
+        printf("Invalid choice!\n");
+        free(transfers);
+        return;
+    }
+    
+    long long startMs = currentTimeMs();
+    int applied = performBulkTransfer(transfers, count, mode == 1);
+    long long elapsedMs = currentTimeMs() - startMs;
+    long long total = 0;
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        if (transfers[i].status == BANK_OK) {
+            total += transfers[i].amount;
+        } else if (transfers[i].status != BANK_ERR_ABORTED) {
+            if (failed++ < LISTING_PAGE_SIZE) {
+                printf("Line %d: %lld -> %lld K " MONEY_FMT ": %s\n", transfers[i].line,
+                       transfers[i].fromAccount, transfers[i].toAccount,
+                       MONEY_ARGS(transfers[i].amount), bankStatusName(transfers[i].status));
+            }
+        }
     }
+    if (failed > LISTING_PAGE_SIZE) {
+        printf("... and %d more failed rows.\n", failed - LISTING_PAGE_SIZE);
+    }
+    if (applied == 0 && failed > 0 && mode == 1) {
+        printf("\nBatch rejected: %d of %d rows failed, nothing was transferred.\n", failed, count);
+    } else {
+        printf("\nApplied %d of %d transfers (K " MONEY_FMT ") in %lld ms.\n",
+               applied, count, MONEY_ARGS(total), elapsedMs);
+    }
+    free(transfers);
+}
+
+void changePassword() {
+    clearScreen();
+    printf("=== MISHTERIOUS BANK - CHANGE PASSWORD ===\n\n");
+    
+    int accountIndex = findAccountIndex(currentUserAccount);
     
     if (accountIndex == -1) {
         printf("Error: Account not found.\n");
@@ -573,10 +6141,11 @@ void changePassword() {
         }
     } while (strcmp(newPassword, confirmPassword) != 0 || !validatePassword(newPassword));
     
-    // Encrypt and store new password
-    strcpy(accounts[accountIndex].password, newPassword);
-    encryptPassword(accounts[accountIndex].password);
-    saveDataToFile();
+    if (performPasswordChange(currentUserAccount, currentPassword, newPassword) != BANK_OK) {
+        printf("Error: Could not change password.\n");
+        pauseScreen();
+        return;
+    }
     
     printf("\n✅ PASSWORD CHANGED SUCCESSFULLY!\n");
     pauseScreen();
@@ -586,13 +6155,7 @@ void displayAccountDetails() {
     clearScreen();
     printf("=== MISHTERIOUS BANK - ACCOUNT DETAILS ===\n\n");
     
-    int accountIndex = -1;
-    for (int i = 0; i < accountCount; i++) {
-        if (accounts[i].accountNumber == currentUserAccount) {
-            accountIndex = i;
-            break;
-        }
-    }
+    int accountIndex = findAccountIndex(currentUserAccount);
     
     if (accountIndex == -1) {
         printf("Error: Account not found.\n");
@@ -601,13 +6164,13 @@ void displayAccountDetails() {
     }
     
     printf("Account Holder: %s\n", accounts[accountIndex].fullName);
-    printf("Account Number: %lld\n", accounts[accountIndex].accountNumber);
-    printf("Account Status: %s\n", accounts[accountIndex].isActive ? "Active" : "Inactive");
-    displayBalance(accounts[accountIndex].balance);
+    printf("Account Number: %lld\n", accountNumbers[accountIndex]);
+    printf("Account Status: %s\n", accountActive[accountIndex] ? "Active" : "Inactive");
+    displayBalance(accountBalances[accountIndex]);
     printf("Password: ******** (hidden for security)\n");
     
     printf("\nRecent Transactions:\n");
-    displayTransactionHistory(currentUserAccount);
+    displayTransactionHistory(currentUserAccount, RECENT_TRANSACTION_COUNT);
     
     pauseScreen();
 }
@@ -620,7 +6183,13 @@ void adminMenu() {
         printf("1. View All Accounts\n");
         printf("2. View Total Bank Balance\n");
         printf("3. Search Account by Number\n");
-        printf("4. Back to Main Menu\n");
+        printf("4. Transaction Log Settings\n");
+        printf("5. Transaction Report\n");
+        printf("6. Generate Statements\n");
+        printf("7. Performance Metrics\n");
+        printf("8. Search Accounts by Name\n");
+        printf("9. Bulk Transfer\n");
+        printf("10. Back to Main Menu\n");
         printf("Enter your choice: ");
         scanf("%d", &choice);
         clearInputBuffer();
@@ -628,34 +6197,14 @@ void adminMenu() {
         switch (choice) {
             case 1:
                 clearScreen();
-                printf("=== ALL ACCOUNTS (%d total) ===\n\n", accountCount);
-                printf("%-20s %-15s %-15s\n", "Account Holder", "Account Number", "Balance (K)");
-                printf("-------------------------------------------------\n");
-                for (int i = 0; i < accountCount; i++) {
-                    if (accounts[i].isActive) {
-                        printf("%-20s %-15lld %-15.2f\n", 
-                               accounts[i].fullName, 
-                               accounts[i].accountNumber, 
-                               accounts[i].balance);
-                    }
-                }
-                pauseScreen();
+                printf("=== ALL ACCOUNTS ===\n\n");
+                browseAccountListing();
                 break;
                 
             case 2:
                 clearScreen();
                 printf("=== TOTAL BANK BALANCE ===\n\n");
-                double totalBalance = 0;
-                int activeAccounts = 0;
-                for (int i = 0; i < accountCount; i++) {
-                    if (accounts[i].isActive) {
-                        totalBalance += accounts[i].balance;
-                        activeAccounts++;
-                    }
-                }
-                printf("Total Bank Assets: K %.2f\n", totalBalance);
-                printf("Total Active Accounts: %d\n", activeAccounts);
-                printf("Total Registered Accounts: %d\n", accountCount);
+                displayBankStatistics();
                 pauseScreen();
                 break;
                 
@@ -668,34 +6217,101 @@ void adminMenu() {
                     scanf("%lld", &searchAcc);
                     clearInputBuffer();
                     
-                    int found = 0;
-                    for (int i = 0; i < accountCount; i++) {
-                        if (accounts[i].accountNumber == searchAcc) {
-                            printf("\nAccount Found:\n");
-                            printf("Holder: %s\n", accounts[i].fullName);
-                            printf("Account Number: %lld\n", accounts[i].accountNumber);
-                            printf("Balance: K %.2f\n", accounts[i].balance);
-                            printf("Status: %s\n", accounts[i].isActive ? "Active" : "Inactive");
-                            found = 1;
-                            break;
-                        }
+                    int i = findAccountIndex(searchAcc);
+                    if (i != -1) {
+                        printf("\nAccount Found:\n");
+                        printf("Holder: %s\n", accounts[i].fullName);
+                        printf("Account Number: %lld\n", accountNumbers[i]);
+                        printf("Balance: K " MONEY_FMT "\n", MONEY_ARGS(accountBalances[i]));
+                        printf("Status: %s\n", accountActive[i] ? "Active" : "Inactive");
+                    } else {
+                        printf("Account not found.\n");
                     }
+                    pauseScreen();
+                }
+                break;
+                
+            case 4:
+                {
+                    clearScreen();
+                    printf("=== TRANSACTION LOG SETTINGS ===\n\n");
+                    displayAppenderStatistics();
                     
-                    if (!found) {
-                        printf("Account not found.\n");
+                    int mode;
+                    printf("\n1. fsync every operation\n");
+                    printf("2. Group commit\n");
+                    printf("3. OS buffered\n");
+                    printf("Select durability mode (0 to keep current): ");
+                    scanf("%d", &mode);
+                    clearInputBuffer();
+                    
+                    if (mode >= 1 && mode <= 3) {
+                        int records = groupCommitRecords;
+                        int intervalMs = groupCommitIntervalMs;
+                        if (mode - 1 == DURABILITY_GROUP) {
+                            printf("Records per group: ");
+                            scanf("%d", &records);
+                            printf("Maximum delay (ms): ");
+                            scanf("%d", &intervalMs);
+                            clearInputBuffer();
+                            if (records < 1) records = 1;
+                            if (intervalMs < 0) intervalMs = 0;
+                        }
+                        pthread_mutex_lock(&logLock);
+                        commitPendingWrites();
+                        durabilityMode = (DurabilityMode)(mode - 1);
+                        groupCommitRecords = records;
+                        groupCommitIntervalMs = intervalMs;
+                        wakePersistenceWriter();
+                        pthread_mutex_unlock(&logLock);
+                        printf("Durability mode updated.\n");
                     }
                     pauseScreen();
                 }
                 break;
                 
-            case 4:
+            case 5:
+                clearScreen();
+                printf("=== TRANSACTION REPORT ===\n\n");
+                displayHistoryReport();
+                pauseScreen();
+                break;
+                
+            case 6:
+                clearScreen();
+                printf("=== GENERATE STATEMENTS ===\n\n");
+                runStatementJob();
+                pauseScreen();
+                break;
+                
+            case 7:
+                clearScreen();
+                printf("=== PERFORMANCE METRICS ===\n\n");
+                displayMetrics();
+                pauseScreen();
+                break;
+                
+            case 8:
+                clearScreen();
+                printf("=== SEARCH ACCOUNTS BY NAME ===\n\n");
+                searchAccountsView();
+                break;
+                
+            case 9:
+                clearScreen();
+                printf("=== BULK TRANSFER ===\n\n");
+                runBulkTransferJob();
+                pauseScreen();
+                break;
+                
+            case 10:
                 break;
                 
             default:
                 printf("Invalid choice. Please try again.\n");
                 pauseScreen();
         }
-    } while (choice != 4);
+    } while (choice != 10);
 }
 
 void userMenu() {
@@ -730,12 +6346,19 @@ void userMenu() {
             case 5:
                 displayAccountDetails();
                 break;
-            case 6:
+            case 6: {
                 clearScreen();
                 printf("=== TRANSACTION HISTORY ===\n\n");
-                displayTransactionHistory(currentUserAccount);
+                time_t from, to;
+                int ranged = readDateRange(&from, &to);
+                if (ranged == 1) {
+                    displayTransactionRange(currentUserAccount, from, to, 0);
+                } else if (ranged == 0) {
+                    displayTransactionHistory(currentUserAccount, 0);
+                }
                 pauseScreen();
                 break;
+            }
             case 7:
                 currentUserAccount = -1;
                 printf("Logged out successfully.\n");
@@ -800,20 +6423,1015 @@ void mainMenu() {
 void initializeSystem() {
     printf("Initializing MISHTERIOUS BANK System...\n");
     loadDataFromFile();
+    replayWriteAheadLog();
+    if (walFile == NULL) {
+        openWriteAheadLog();
+    }
+    loadHistoryIndex();
+    if (legacyDataLoaded) {
+        // Rewrite the converted accounts in the current format
+        checkpoint();
+    }
+    startPersistenceWriter();
+    startMetricsDumper();
     printf("System ready!\n");
-    sleep(1);
+    if (!batchMode) {
+        sleep(1);
+    }
 }
 
 void cleanup() {
-    if (accounts != NULL) {
-        free(accounts);
-        accounts = NULL;
+    stopLoginPool();
+    stopPersistenceWriter();
+    closeTransactionAppender();
+    if (walRecordCount > 0) {
+        checkpoint();
+    }
+    stopMetricsDumper();
+    if (walFile != NULL) {
+        fclose(walFile);
+        walFile = NULL;
+    }
+    releaseAccountStorage();
+    resetBankStatistics();
+    if (accountIndexSlots != NULL) {
+        free(accountIndexSlots);
+        accountIndexSlots = NULL;
+        accountIndexCapacity = 0;
+    }
+    nameIndexCount = 0;
+    freeShards();
+    freeNamePool();
+    resetAccountNumbers();
+}
+
+// Batch mode
+// Reads one operation per line and writes one result line per operation:
+//   deposit <account> <amount>           withdraw <account> <amount>
+//   transfer <from> <to> <amount>        passwd <account> <old> <new>
+//   login <account> <password>           balance <account>
+//   history <account> [limit [from to]]  register <password> <deposit> <full name>
+//   list <key> [limit] [cursor]          export <key>
+//   report <from> <to>                   statements <from> <to> [directory]
+//   find <prefix|contains> <limit> <cursor> <text>
+//   bulk <atomic|partial> <file>
+// Results are "OK <op> <account> ..." or "ERR <op> <account> <STATUS>"; history
+// rows are printed as "TX ..." lines before the OK line. Dates are YYYY-MM-DD
+// and ranges include both days; history with limit 0 and a range returns the
+// whole range. report prints "REPORT <type> <count> <amount>" per transaction
+// type, then "OK report - records=<n> segments=<read>/<total>". statements
+// writes one statement per account (see generateStatements) and prints
+// "OK statements - count=<statements> records=<n>". list and export take
+// balance, number or name as the sort key; see runBatchList, and
+// runBatchFind for find. bulk runs a transfer file (see loadBulkTransfers),
+// prints "FAIL <line> <from> <to> <STATUS>" for each row that was not
+// applied, then "OK bulk - applied=<n> failed=<n>"; an atomic batch with a
+// failed row applies nothing. Blank lines and lines starting with # are
+// skipped. Runs of consecutive login lines are checked together on the
+// login pool; results still come out in order.
+// Returns the number of failed operations.
+// list <key> [limit] [cursor] prints up to limit "ROW <account> <balance>
+// <name>" lines that follow cursor in the listing, then "OK list - count=<rows>
+// next=<cursor>". A cursor is <account>:<balance> of a row, as printed in
+// next=; "-" (or none) starts from the top and next=- marks the end.
+int runBatchList(const char *line) {
+    char keyText[16];
+    char cursorText[64] = "-";
+    int limit = LISTING_PAGE_SIZE;
+    ListingSortKey key;
+    int fields = sscanf(line, "%*s %15s %d %63s", keyText, &limit, cursorText);
+    if (fields < 1 || !parseSortKey(keyText, &key) || limit < 1) {
+        printf("ERR list - SYNTAX\n");
+        return 1;
+    }
+    
+    ListingEntry cursor;
+    ListingEntry *after = NULL;
+    if (strcmp(cursorText, "-") != 0) {
+        if (sscanf(cursorText, "%lld:%lld", &cursor.accountNumber, &cursor.balance) != 2) {
+            printf("ERR list - SYNTAX\n");
+            return 1;
+        }
+        int position = findAccountIndex(cursor.accountNumber);
+        if (position == -1) {
+            printf("ERR list %lld %s\n", cursor.accountNumber, bankStatusName(BANK_ERR_NOT_FOUND));
+            return 1;
+        }
+        cursor.name = accounts[position].fullName;
+        after = &cursor;
+    }
+    
+    int count;
+    ListingEntry *entries = buildAccountListing(key, &count);
+    BulkWriter writer;
+    if (entries == NULL || !openBulkWriter(&writer, STDOUT_FILENO)) {
+        free(entries);
+        printf("ERR list - %s\n", bankStatusName(BANK_ERR_STORAGE));
+        return 1;
+    }
+    int start = seekListing(entries, count, key, after);
+    int end = (count - start > limit) ? start + limit : count;
+    fflush(stdout);
+    for (int i = start; i < end; i++) {
+        bulkPrintf(&writer, "ROW %lld " MONEY_FMT " %s\n",
+                   entries[i].accountNumber, MONEY_ARGS(entries[i].balance), entries[i].name);
+    }
+    if (end < count) {
+        bulkPrintf(&writer, "OK list - count=%d next=%lld:%lld\n", end - start,
+                   entries[end - 1].accountNumber, entries[end - 1].balance);
+    } else {
+        bulkPrintf(&writer, "OK list - count=%d next=-\n", end - start);
+    }
+    closeBulkWriter(&writer);
+    free(entries);
+    return 0;
+}
+
+// find <prefix|contains> <limit> <cursor> <text> prints up to limit
+// "MATCH <account> <balance> <active> <name>" lines for accounts whose
+// name starts with or contains text (the rest of the line, ignoring
+// case), then "OK find - count=<rows> next=<cursor>". The cursor is the
+// account number of the last row; "-" starts from the top and next=-
+// marks the end.
+int runBatchFind(const char *line) {
+    char matchText[16];
+    char cursorText[32];
+    int limit;
+    int textStart = 0;
+    NameMatch match;
+    if (sscanf(line, "%*s %15s %d %31s %n", matchText, &limit, cursorText, &textStart) != 3 ||
+        textStart == 0 || limit < 1) {
+        printf("ERR find - SYNTAX\n");
+        return 1;
+    }
+    if (strcmp(matchText, "prefix") == 0) {
+        match = NAME_MATCH_PREFIX;
+    } else if (strcmp(matchText, "contains") == 0) {
+        match = NAME_MATCH_SUBSTRING;
+    } else {
+        printf("ERR find - SYNTAX\n");
+        return 1;
+    }
+    long long after = -1;
+    if (strcmp(cursorText, "-") != 0 && sscanf(cursorText, "%lld", &after) != 1) {
+        printf("ERR find - SYNTAX\n");
+        return 1;
+    }
+    
+    NameSearchRow *rows = malloc(limit * sizeof(NameSearchRow));
+    if (rows == NULL) {
+        printf("ERR find - %s\n", bankStatusName(BANK_ERR_STORAGE));
+        return 1;
+    }
+    int more;
+    int count = searchAccountsByName(line + textStart, match, after, rows, limit, &more);
+    if (count < 0) {
+        printf("ERR find %lld %s\n", after, bankStatusName(BANK_ERR_NOT_FOUND));
+        free(rows);
+        return 1;
+    }
+    for (int i = 0; i < count; i++) {
+        printf("MATCH %lld " MONEY_FMT " %d %s\n",
+               rows[i].accountNumber, MONEY_ARGS(rows[i].balance), rows[i].isActive, rows[i].name);
+    }
+    if (more) {
+        printf("OK find - count=%d next=%lld\n", count, rows[count - 1].accountNumber);
+    } else {
+        printf("OK find - count=%d next=-\n", count);
+    }
+    free(rows);
+    return 0;
+}
+
+int printBatchResult(const char *op, long long accNum, BankStatus status) {
+    if (status != BANK_OK) {
+        printf("ERR %s %lld %s\n", op, accNum, bankStatusName(status));
+        return 1;
+    }
+    int position = findAccountIndex(accNum);
+    printf("OK %s %lld balance=" MONEY_FMT "\n", op, accNum, MONEY_ARGS(accountBalances[position]));
+    return 0;
+}
+
+int flushBatchLogins(LoginRequest *logins, int *count) {
+    int failures = 0;
+    if (*count > 0) {
+        performLogins(logins, *count);
+        for (int i = 0; i < *count; i++) {
+            failures += printBatchResult("login", logins[i].accountNumber, logins[i].status);
+        }
+        *count = 0;
+    }
+    return failures;
+}
+
+int runBatch(FILE *input) {
+    char line[512];
+    char op[32];
+    char arg1[MAX_NAME_LENGTH];
+    char arg2[MAX_NAME_LENGTH];
+    char amountText[32];
+    LoginRequest logins[LOGIN_BURST_MAX];
+    int loginCount = 0;
+    int failures = 0;
+    
+    while (fgets(line, sizeof(line), input) != NULL) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0] == '\0' || line[0] == '#' || sscanf(line, "%31s", op) != 1) {
+            continue;
+        }
+        
+        long long accNum = 0;
+        if (strcmp(op, "login") == 0 && sscanf(line, "%*s %lld %99s", &accNum, arg1) == 2 &&
+            strlen(arg1) < MAX_PASSWORD_LENGTH) {
+            logins[loginCount].accountNumber = accNum;
+            strcpy(logins[loginCount].password, arg1);
+            if (++loginCount == LOGIN_BURST_MAX) {
+                failures += flushBatchLogins(logins, &loginCount);
+            }
+            continue;
+        }
+        failures += flushBatchLogins(logins, &loginCount);
+        
+        accNum = 0;
+        long long otherAcc = 0;
+        long long amount = 0;
+        int limit = 0;
+        int position;
+        BankStatus status;
+        
+        if (strcmp(op, "deposit") == 0 && sscanf(line, "%*s %lld %31s", &accNum, amountText) == 2) {
+            status = parseMoney(amountText, &amount) ? performDeposit(accNum, amount) : BANK_ERR_INVALID_AMOUNT;
+        } else if (strcmp(op, "withdraw") == 0 && sscanf(line, "%*s %lld %31s", &accNum, amountText) == 2) {
+            status = parseMoney(amountText, &amount) ? performWithdrawal(accNum, amount) : BANK_ERR_INVALID_AMOUNT;
+        } else if (strcmp(op, "transfer") == 0 && sscanf(line, "%*s %lld %lld %31s", &accNum, &otherAcc, amountText) == 3) {
+            status = parseMoney(amountText, &amount) ? performTransfer(accNum, otherAcc, amount) : BANK_ERR_INVALID_AMOUNT;
+        } else if (strcmp(op, "passwd") == 0 && sscanf(line, "%*s %lld %99s %99s", &accNum, arg1, arg2) == 3) {
+            status = performPasswordChange(accNum, arg1, arg2);
+        } else if (strcmp(op, "login") == 0 && sscanf(line, "%*s %lld %99s", &accNum, arg1) == 2) {
+            status = performLogin(accNum, arg1, &position);
+        } else if (strcmp(op, "balance") == 0 && sscanf(line, "%*s %lld", &accNum) == 1) {
+            status = (findAccountIndex(accNum) == -1) ? BANK_ERR_NOT_FOUND : BANK_OK;
+        } else if (strcmp(op, "history") == 0 && sscanf(line, "%*s %lld", &accNum) == 1) {
+            time_t from = (time_t)LLONG_MIN;
+            time_t to = (time_t)LLONG_MAX;
+            int fields = sscanf(line, "%*s %*s %d %99s %99s", &limit, arg1, arg2);
+            if (fields == 2 || (fields == 3 && !parseDateRange(arg1, arg2, &from, &to))) {
+                printf("ERR history %lld SYNTAX\n", accNum);
+                failures++;
+                continue;
+            }
+            Transaction *records;
+            int count = readTransactionRange(accNum, from, to, (limit > 0) ? limit : 0, &records);
+            for (int i = 0; i < count; i++) {
+                printf("TX %lld %s " MONEY_FMT " " MONEY_FMT " %lld %lld\n",
+                       records[i].accountNumber, transactionTypeNames[records[i].type],
+                       MONEY_ARGS(records[i].amount), MONEY_ARGS(records[i].balanceAfter),
+                       (long long)records[i].timestamp, records[i].targetAccount);
+            }
+            free(records);
+            status = (findAccountIndex(accNum) == -1) ? BANK_ERR_NOT_FOUND : BANK_OK;
+            if (status == BANK_OK) {
+                printf("OK history %lld count=%d\n", accNum, (count > 0) ? count : 0);
+                continue;
+            }
+        } else if (strcmp(op, "report") == 0) {
+            time_t from, to;
+            HistoryReport report;
+            if (sscanf(line, "%*s %99s %99s", arg1, arg2) != 2 || !parseDateRange(arg1, arg2, &from, &to)) {
+                printf("ERR report - SYNTAX\n");
+                failures++;
+            } else if (!buildHistoryReport(from, to, &report)) {
+                printf("ERR report - %s\n", bankStatusName(BANK_ERR_STORAGE));
+                failures++;
+            } else {
+                for (int type = 0; type < TRANSACTION_TYPES; type++) {
+                    printf("REPORT %s %lld " MONEY_FMT "\n", transactionTypeNames[type],
+                           report.counts[type], MONEY_ARGS(report.amounts[type]));
+                }
+                printf("OK report - records=%lld segments=%d/%d\n",
+                       report.records, report.segmentsRead, report.segmentCount);
+            }
+            continue;
+        } else if (strcmp(op, "statements") == 0) {
+            time_t from, to;
+            char directory[MAX_NAME_LENGTH] = STATEMENT_DEFAULT_DIRECTORY;
+            int records;
+            int fields = sscanf(line, "%*s %99s %99s %99s", arg1, arg2, directory);
+            if (fields < 2 || !parseDateRange(arg1, arg2, &from, &to)) {
+                printf("ERR statements - SYNTAX\n");
+                failures++;
+                continue;
+            }
+            int written = generateStatements(from, to, directory, &records);
+            if (written < 0) {
+                printf("ERR statements - %s\n", bankStatusName(BANK_ERR_STORAGE));
+                failures++;
+            } else {
+                printf("OK statements - count=%d records=%d\n", written, records);
+            }
+            continue;
+        } else if (strcmp(op, "list") == 0) {
+            failures += runBatchList(line);
+            continue;
+        } else if (strcmp(op, "find") == 0) {
+            failures += runBatchFind(line);
+            continue;
+        } else if (strcmp(op, "bulk") == 0) {
+            int pathStart = 0;
+            BulkTransfer *transfers = NULL;
+            int count = -1;
+            if (sscanf(line, "%*s %31s %n", arg1, &pathStart) == 1 && pathStart > 0 &&
+                (strcmp(arg1, "atomic") == 0 || strcmp(arg1, "partial") == 0)) {
+                count = loadBulkTransfers(line + pathStart, &transfers);
+            }
+            if (count < 0) {
+                printf("ERR bulk - SYNTAX\n");
+                failures++;
+                continue;
+            }
+            int applied = performBulkTransfer(transfers, count, strcmp(arg1, "atomic") == 0);
+            for (int i = 0; i < count; i++) {
+                if (transfers[i].status != BANK_OK) {
+                    printf("FAIL %d %lld %lld %s\n", transfers[i].line, transfers[i].fromAccount,
+                           transfers[i].toAccount, bankStatusName(transfers[i].status));
+                }
+            }
+            printf("OK bulk - applied=%d failed=%d\n", applied, count - applied);
+            if (applied < count) failures++;
+            free(transfers);
+            continue;
+        } else if (strcmp(op, "export") == 0) {
+            ListingSortKey key;
+            int rows = -1;
+            if (sscanf(line, "%*s %31s", arg1) == 1 && parseSortKey(arg1, &key)) {
+                fflush(stdout);
+                rows = exportAccountListing(key, STDOUT_FILENO);
+            }
+            if (rows < 0) {
+                printf("ERR export - %s\n", bankStatusName(BANK_ERR_STORAGE));
+                failures++;
+            } else {
+                printf("OK export - count=%d\n", rows);
+            }
+            continue;
+        } else if (strcmp(op, "register") == 0) {
+            int nameStart = 0;
+            if (sscanf(line, "%*s %99s %31s %n", arg1, amountText, &nameStart) != 2 || nameStart == 0) {
+                printf("ERR register - SYNTAX\n");
+                failures++;
+                continue;
+            }
+            status = parseMoney(amountText, &amount)
+                ? performRegistration(line + nameStart, arg1, amount, &accNum)
+                : BANK_ERR_INVALID_AMOUNT;
+        } else {
+            printf("ERR %s - SYNTAX\n", op);
+            failures++;
+            continue;
+        }
+        
+        failures += printBatchResult(op, accNum, status);
+    }
+    failures += flushBatchLogins(logins, &loginCount);
+    return failures;
+}
+
+// Stress test
+// Runs deposits, withdrawals, transfers and registrations from several
+// threads against a scratch book in a temporary directory, then checks
+// that the money in the book equals the money that entered and left it.
+// Meanwhile an auditor takes book snapshots, each of which must add up to
+// the statistics total recorded at its instant.
+typedef struct {
+    unsigned int seed;
+    int operations;
+    long long deposited;
+    long long withdrawn;
+    long long opened;
+    int failures;
+} StressWorker;
+
+typedef struct {
+    int stop;
+    int snapshots;
+    int torn;
+} StressAuditor;
+
+void *stressAuditorMain(void *arg) {
+    StressAuditor *auditor = arg;
+    while (!__atomic_load_n(&auditor->stop, __ATOMIC_ACQUIRE)) {
+        BookSnapshot *snapshot = takeBookSnapshot();
+        if (snapshot == NULL) {
+            auditor->torn++;
+            break;
+        }
+        long long total;
+        int active;
+        computeBankTotals(snapshot, &total, &active);
+        if (total != snapshot->statisticsTotal) {
+            auditor->torn++;
+        }
+        auditor->snapshots++;
+        freeBookSnapshot(snapshot);
+    }
+    return NULL;
+}
+
+void *stressWorkerMain(void *arg) {
+    StressWorker *worker = arg;
+    for (int i = 0; i < worker->operations; i++) {
+        long long from = SYNTHETIC_ACCOUNT_BASE + rand_r(&worker->seed) % STRESS_ACCOUNTS;
+        long long to = SYNTHETIC_ACCOUNT_BASE + rand_r(&worker->seed) % STRESS_ACCOUNTS;
+        long long amount = 100 * (1 + rand_r(&worker->seed) % 50);
+        int kind = rand_r(&worker->seed) % 100;
+        
+        if (kind < 50) {
+            BankStatus status = performTransfer(from, to, amount);
+            if (status != BANK_OK && status != BANK_ERR_SAME_ACCOUNT && status != BANK_ERR_INSUFFICIENT_FUNDS) {
+                worker->failures++;
+            }
+        } else if (kind < 70) {
+            if (performDeposit(from, amount) == BANK_OK) {
+                worker->deposited += amount;
+            } else {
+                worker->failures++;
+            }
+        } else if (kind < 95) {
+            BankStatus status = performWithdrawal(from, amount);
+            if (status == BANK_OK) {
+                worker->withdrawn += amount;
+            } else if (status != BANK_ERR_INSUFFICIENT_FUNDS) {
+                worker->failures++;
+            }
+        } else {
+            long long accNum;
+            if (performRegistration("Stress Test", "Stress1", MINIMUM_OPENING_DEPOSIT, &accNum) == BANK_OK) {
+                worker->opened += MINIMUM_OPENING_DEPOSIT;
+            } else {
+                worker->failures++;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Creates a scratch directory from template and makes it the working
+// directory, so synthetic runs never touch the real bank files.
+int enterScratchDirectory(char *directory) {
+    if (mkdtemp(directory) == NULL || chdir(directory) != 0) {
+        fprintf(stderr, "Error: Could not create a scratch directory.\n");
+        return 0;
+    }
+    return 1;
+}
+
+void removeScratchDirectory(const char *directory) {
+    unlink(FILENAME);
+    for (int i = 0; i < ACCOUNT_SHARDS; i++) {
+        char path[64];
+        snprintf(path, sizeof(path), SNAPSHOT_SHARD_FILE, i);
+        unlink(path);
+    }
+    unlink(WAL_FILE);
+    unlink(TRANSACTION_HISTORY_FILE);
+    unlink(METRICS_FILE);
+    removeHistorySegments();
+    if (chdir("/") == 0) {
+        rmdir(directory);
+    }
+}
+
+// Adds count accounts numbered from SYNTHETIC_ACCOUNT_BASE and writes them
+// to the snapshot. password may be NULL for accounts nobody logs in to.
+void createSyntheticAccounts(const char *name, int count, long long balance, const char *password) {
+    AccountRecord record;
+    memset(&record, 0, sizeof(AccountRecord));
+    strcpy(record.fullName, name);
+    // One hash shared by every account keeps setup fast at any cost
+    if (password != NULL && !hashPassword(password, record.password)) {
+        fprintf(stderr, "Error: Could not hash the synthetic password.\n");
+    }
+    record.balance = balance;
+    record.isActive = 1;
+    for (int i = 0; i < count; i++) {
+        record.accountNumber = SYNTHETIC_ACCOUNT_BASE + i;
+        addAccount(&record);
+    }
+    checkpoint();
+}
+
+int runStressTest(int threadCount, int opsPerThread) {
+    char directory[] = "/tmp/mishterious_stress_XXXXXX";
+    if (!enterScratchDirectory(directory)) {
+        return 1;
+    }
+    
+    // The stress test exercises locking, not password hashing
+    durabilityMode = DURABILITY_OS;
+    passwordHashCost = STRESS_PASSWORD_HASH_COST;
+    initializeSystem();
+    createSyntheticAccounts("Stress Account", STRESS_ACCOUNTS, STRESS_OPENING_BALANCE, NULL);
+    
+    StressWorker *workers = calloc(threadCount, sizeof(StressWorker));
+    pthread_t *threads = calloc(threadCount, sizeof(pthread_t));
+    if (workers == NULL || threads == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed.\n");
+        free(workers);
+        free(threads);
+        return 1;
+    }
+    
+    StressAuditor auditor = {0, 0, 0};
+    pthread_t auditorThread;
+    long long startMs = currentTimeMs();
+    for (int i = 0; i < threadCount; i++) {
+        workers[i].seed = 12345u + i;
+        workers[i].operations = opsPerThread;
+        pthread_create(&threads[i], NULL, stressWorkerMain, &workers[i]);
+    }
+    int auditing = (pthread_create(&auditorThread, NULL, stressAuditorMain, &auditor) == 0);
+    
+    long long expected = (long long)STRESS_ACCOUNTS * STRESS_OPENING_BALANCE;
+    int failures = 0;
+    for (int i = 0; i < threadCount; i++) {
+        pthread_join(threads[i], NULL);
+        expected += workers[i].deposited + workers[i].opened - workers[i].withdrawn;
+        failures += workers[i].failures;
+    }
+    long long elapsedMs = currentTimeMs() - startMs;
+    if (auditing) {
+        __atomic_store_n(&auditor.stop, 1, __ATOMIC_RELEASE);
+        pthread_join(auditorThread, NULL);
+    }
+    
+    long long total = 0;
+    long long richest = 0;
+    int negative = 0;
+    for (int i = 0; i < accountCount; i++) {
+        total += accountBalances[i];
+        if (accountBalances[i] > richest) richest = accountBalances[i];
+        if (accountBalances[i] < 0) negative++;
+    }
+    
+    // The incrementally kept statistics must agree with the scan
+    BalanceHeapEntry top[1];
+    int statsAgree = (statsTotalBalance == total && statsActiveAccounts == accountCount &&
+                      topBalances(top, 1) == 1 && top[0].balance == richest);
+    
+    printf("Threads: %d, operations: %d, accounts: %d, time: %lld ms\n",
+           threadCount, threadCount * opsPerThread, accountCount, elapsedMs);
+    printf("Expected total: K " MONEY_FMT "\n", MONEY_ARGS(expected));
+    printf("Actual total:   K " MONEY_FMT "\n", MONEY_ARGS(total));
+    printf("Statistics:     %s\n", statsAgree ? "match the accounts" : "DO NOT match the accounts");
+    printf("Snapshots:      %d taken, %d inconsistent\n", auditor.snapshots, auditor.torn);
+    
+    int passed = (total == expected && negative == 0 && failures == 0 && statsAgree && auditor.torn == 0);
+    printf("%s\n", passed ? "PASS: money conserved" : "FAIL");
+    
+    free(workers);
+    free(threads);
+    cleanup();
+    removeScratchDirectory(directory);
+    return passed ? 0 : 1;
+}
+
+// Benchmark
+// Drives a seeded synthetic workload through the perform* functions on one
+// thread and reports, per operation type, throughput, latency percentiles
+// and the bytes and fsyncs each operation cost. The same seed, account
+// count, operation count and mix always produce the same operations.
+typedef enum {
+    BENCH_DEPOSIT,
+    BENCH_WITHDRAW,
+    BENCH_TRANSFER,
+    BENCH_LOGIN,
+    BENCH_HISTORY,
+    BENCH_OPERATION_TYPES
+} BenchOperation;
+
+typedef struct {
+    unsigned long long seed;
+    int accounts;
+    int operations;
+    int mix[BENCH_OPERATION_TYPES];
+} BenchConfig;
+
+typedef struct {
+    int count;
+    long long *latenciesNs;
+    long long totalNs;
+    long long bytes;
+    long long fsyncs;
+} BenchStats;
+
+const char *benchOperationNames[BENCH_OPERATION_TYPES] = {
+    "deposit", "withdraw", "transfer", "login", "history"
+};
+
+long long currentTimeNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// xorshift64*: small, fast and identical on every platform, unlike rand()
+unsigned long long benchRandom(unsigned long long *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+int compareLongLong(const void *a, const void *b) {
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted values, in microseconds
+double percentileUs(const long long *sorted, int count, double percentile) {
+    if (count == 0) return 0;
+    int rank = (int)(percentile * count + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > count) rank = count;
+    return sorted[rank - 1] / 1000.0;
+}
+
+// Parses a mix such as "30,20,30,10,10" (deposit, withdraw, transfer,
+// login, history weights).
+int parseBenchMix(const char *text, int *mix) {
+    int consumed = 0;
+    if (sscanf(text, "%d,%d,%d,%d,%d%n", &mix[0], &mix[1], &mix[2], &mix[3], &mix[4], &consumed) != 5 ||
+        text[consumed] != '\0') {
+        return 0;
+    }
+    int total = 0;
+    for (int i = 0; i < BENCH_OPERATION_TYPES; i++) {
+        if (mix[i] < 0) return 0;
+        total += mix[i];
+    }
+    return total > 0;
+}
+
+int runBenchmark(const BenchConfig *config) {
+    char directory[] = "/tmp/mishterious_bench_XXXXXX";
+    if (!enterScratchDirectory(directory)) {
+        return 1;
+    }
+    
+    BenchStats stats[BENCH_OPERATION_TYPES];
+    memset(stats, 0, sizeof(stats));
+    for (int i = 0; i < BENCH_OPERATION_TYPES; i++) {
+        stats[i].latenciesNs = malloc(config->operations * sizeof(long long));
+        if (stats[i].latenciesNs == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed.\n");
+            for (int j = 0; j < i; j++) free(stats[j].latenciesNs);
+            removeScratchDirectory(directory);
+            return 1;
+        }
+    }
+    
+    initializeSystem();
+    createSyntheticAccounts("Bench Account", config->accounts, STRESS_OPENING_BALANCE, BENCH_PASSWORD);
+    
+    int mixTotal = 0;
+    for (int i = 0; i < BENCH_OPERATION_TYPES; i++) {
+        mixTotal += config->mix[i];
+    }
+    
+    unsigned long long state = config->seed ? config->seed : 1;
+    int failures = 0;
+    long long startNs = currentTimeNs();
+    for (int i = 0; i < config->operations; i++) {
+        int pick = (int)(benchRandom(&state) % mixTotal);
+        BenchOperation op = BENCH_DEPOSIT;
+        while (pick >= config->mix[op]) {
+            pick -= config->mix[op];
+            op++;
+        }
+        long long from = SYNTHETIC_ACCOUNT_BASE + (long long)(benchRandom(&state) % config->accounts);
+        long long to = SYNTHETIC_ACCOUNT_BASE + (long long)(benchRandom(&state) % config->accounts);
+        long long amount = 100 * (1 + (long long)(benchRandom(&state) % 50));
+        
+        // The persistence writer updates fsyncCount under logLock
+        pthread_mutex_lock(&logLock);
+        long long bytesBefore = bytesWritten;
+        long long fsyncsBefore = fsyncCount;
+        pthread_mutex_unlock(&logLock);
+        long long opStartNs = currentTimeNs();
+        BankStatus status = BANK_OK;
+        switch (op) {
+            case BENCH_DEPOSIT:
+                status = performDeposit(from, amount);
+                break;
+            case BENCH_WITHDRAW:
+                status = performWithdrawal(from, amount);
+                if (status == BANK_ERR_INSUFFICIENT_FUNDS) status = BANK_OK;
+                break;
+            case BENCH_TRANSFER:
+                status = performTransfer(from, to, amount);
+                if (status == BANK_ERR_INSUFFICIENT_FUNDS || status == BANK_ERR_SAME_ACCOUNT) status = BANK_OK;
+                break;
+            case BENCH_LOGIN: {
+                int position;
+                status = performLogin(from, BENCH_PASSWORD, &position);
+                break;
+            }
+            case BENCH_HISTORY: {
+                Transaction *records;
+                if (readTransactionHistory(from, RECENT_TRANSACTION_COUNT, &records) < 0) {
+                    status = BANK_ERR_STORAGE;
+                } else {
+                    free(records);
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        long long elapsedNs = currentTimeNs() - opStartNs;
+        
+        BenchStats *entry = &stats[op];
+        entry->latenciesNs[entry->count++] = elapsedNs;
+        entry->totalNs += elapsedNs;
+        pthread_mutex_lock(&logLock);
+        entry->bytes += bytesWritten - bytesBefore;
+        entry->fsyncs += fsyncCount - fsyncsBefore;
+        pthread_mutex_unlock(&logLock);
+        if (status != BANK_OK) failures++;
+    }
+    long long wallNs = currentTimeNs() - startNs;
+    
+    const char *modeNames[] = {"fsync", "group", "os"};
+    printf("Seed: %llu, accounts: %d, operations: %d, durability: %s, password cost: %d\n",
+           config->seed, config->accounts, config->operations, modeNames[durabilityMode], passwordHashCost);
+    printf("%-9s %8s %12s %10s %10s %10s %12s %10s\n",
+           "op", "count", "ops/s", "p50 us", "p99 us", "p999 us", "bytes/op", "fsyncs/op");
+    
+    long long *all = malloc(config->operations * sizeof(long long));
+    int allCount = 0;
+    long long totalBytes = 0;
+    long long totalFsyncs = 0;
+    for (int i = 0; i < BENCH_OPERATION_TYPES; i++) {
+        BenchStats *entry = &stats[i];
+        if (all != NULL) {
+            memcpy(all + allCount, entry->latenciesNs, entry->count * sizeof(long long));
+        }
+        allCount += entry->count;
+        totalBytes += entry->bytes;
+        totalFsyncs += entry->fsyncs;
+        if (entry->count == 0) continue;
+        
+        qsort(entry->latenciesNs, entry->count, sizeof(long long), compareLongLong);
+        printf("%-9s %8d %12.0f %10.1f %10.1f %10.1f %12.1f %10.3f\n",
+               benchOperationNames[i], entry->count,
+               entry->count / (entry->totalNs / 1e9),
+               percentileUs(entry->latenciesNs, entry->count, 0.50),
+               percentileUs(entry->latenciesNs, entry->count, 0.99),
+               percentileUs(entry->latenciesNs, entry->count, 0.999),
+               (double)entry->bytes / entry->count,
+               (double)entry->fsyncs / entry->count);
+    }
+    if (all != NULL && allCount > 0) {
+        qsort(all, allCount, sizeof(long long), compareLongLong);
+        printf("%-9s %8d %12.0f %10.1f %10.1f %10.1f %12.1f %10.3f\n",
+               "all", allCount, allCount / (wallNs / 1e9),
+               percentileUs(all, allCount, 0.50),
+               percentileUs(all, allCount, 0.99),
+               percentileUs(all, allCount, 0.999),
+               (double)totalBytes / allCount,
+               (double)totalFsyncs / allCount);
+    }
+    printf("Unexpected failures: %d\n", failures);
+    
+    free(all);
+    for (int i = 0; i < BENCH_OPERATION_TYPES; i++) {
+        free(stats[i].latenciesNs);
     }
+    cleanup();
+    removeScratchDirectory(directory);
+    return (failures > 0) ? 1 : 0;
 }
 
-int main() {
+// Login benchmark
+// Times the same logins run one after another on the calling thread and
+// then in bursts on the login pool, at the current password hash cost.
+int runLoginBenchmark(int logins) {
+    char directory[] = "/tmp/mishterious_login_XXXXXX";
+    if (!enterScratchDirectory(directory)) {
+        return 1;
+    }
+    
+    LoginRequest *requests = calloc(logins, sizeof(LoginRequest));
+    if (requests == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed.\n");
+        removeScratchDirectory(directory);
+        return 1;
+    }
+    
     initializeSystem();
-    mainMenu();
+    createSyntheticAccounts("Bench Account", LOGIN_BENCH_ACCOUNTS, STRESS_OPENING_BALANCE, BENCH_PASSWORD);
+    for (int i = 0; i < logins; i++) {
+        requests[i].accountNumber = SYNTHETIC_ACCOUNT_BASE + i % LOGIN_BENCH_ACCOUNTS;
+        strcpy(requests[i].password, BENCH_PASSWORD);
+    }
+    
+    int failures = 0;
+    long long startNs = currentTimeNs();
+    for (int i = 0; i < logins; i++) {
+        int position;
+        if (performLogin(requests[i].accountNumber, requests[i].password, &position) != BANK_OK) failures++;
+    }
+    long long sequentialNs = currentTimeNs() - startNs;
+    
+    startNs = currentTimeNs();
+    for (int i = 0; i < logins; i += LOGIN_BURST_MAX) {
+        int burst = (logins - i < LOGIN_BURST_MAX) ? logins - i : LOGIN_BURST_MAX;
+        performLogins(requests + i, burst);
+    }
+    long long poolNs = currentTimeNs() - startNs;
+    for (int i = 0; i < logins; i++) {
+        if (requests[i].status != BANK_OK) failures++;
+    }
+    
+    double sequentialRate = logins / (sequentialNs / 1e9);
+    double poolRate = logins / (poolNs / 1e9);
+    printf("Password cost: 2^%d (%lld KiB per hash), logins: %d\n", passwordHashCost,
+           (128LL * PASSWORD_HASH_BLOCK_SIZE << passwordHashCost) / 1024, logins);
+    printf("Sequential: %10.1f logins/s\n", sequentialRate);
+    printf("Pool (%d threads): %10.1f logins/s (%.2fx)\n", loginWorkerCount, poolRate, poolRate / sequentialRate);
+    printf("Failed logins: %d\n", failures);
+    
+    free(requests);
     cleanup();
-    return 0;
+    removeScratchDirectory(directory);
+    return (failures > 0) ? 1 : 0;
+}
+
+int parseDurabilityMode(const char *text, DurabilityMode *mode) {
+    if (strcmp(text, "fsync") == 0) {
+        *mode = DURABILITY_FSYNC_EACH;
+    } else if (strcmp(text, "group") == 0) {
+        *mode = DURABILITY_GROUP;
+    } else if (strcmp(text, "os") == 0) {
+        *mode = DURABILITY_OS;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+void printUsage(const char *program) {
+    fprintf(stderr, "Usage: %s [--batch [--durability fsync|group|os] [FILE]]\n", program);
+    fprintf(stderr, "       %s --stress [THREADS] [OPERATIONS_PER_THREAD]\n", program);
+    fprintf(stderr, "       %s --bench [--seed N] [--accounts N] [--ops N] [--mix D,W,T,L,H]\n"
+                    "              [--durability fsync|group|os]\n", program);
+    fprintf(stderr, "       %s --login-bench [LOGINS]\n", program);
+    fprintf(stderr, "Other modes also take --password-cost N (log2 of the scrypt work factor,\n"
+                    "1-%d, default %d), --login-workers N (default: one per CPU),\n"
+                    "--segment-kb N (history segment size, default %ld) and\n"
+                    "--metrics-interval SECONDS (rewrite %s in the current\n"
+                    "directory that often; off by default).\n",
+            PASSWORD_HASH_MAX_COST, PASSWORD_HASH_DEFAULT_COST, HISTORY_SEGMENT_MAX_BYTES / 1024,
+            METRICS_FILE);
+}
+
+// Removes the options shared by every mode from argv. Returns 0 if one
+// of them has a bad value.
+int parseCommonOptions(int *argc, char *argv[]) {
+    int kept = 1;
+    for (int i = 1; i < *argc; i++) {
+        if (strcmp(argv[i], "--password-cost") == 0 && i + 1 < *argc) {
+            passwordHashCost = atoi(argv[++i]);
+            if (passwordHashCost < 1 || passwordHashCost > PASSWORD_HASH_MAX_COST) return 0;
+        } else if (strcmp(argv[i], "--login-workers") == 0 && i + 1 < *argc) {
+            loginWorkerCount = atoi(argv[++i]);
+            if (loginWorkerCount < 1) return 0;
+        } else if (strcmp(argv[i], "--metrics-interval") == 0 && i + 1 < *argc) {
+            metricsDumpInterval = atoi(argv[++i]);
+            if (metricsDumpInterval < 0) return 0;
+        } else if (strcmp(argv[i], "--segment-kb") == 0 && i + 1 < *argc) {
+            historySegmentMaxBytes = atol(argv[++i]) * 1024;
+            if (historySegmentMaxBytes < 1024) return 0;
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    *argc = kept;
+    argv[kept] = NULL;
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    initializeLocks();
+    if (!parseCommonOptions(&argc, argv)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    
+    if (argc > 1 && strcmp(argv[1], "--stress") == 0) {
+        int threadCount = (argc > 2) ? atoi(argv[2]) : 8;
+        int opsPerThread = (argc > 3) ? atoi(argv[3]) : 100000;
+        if (threadCount < 1 || opsPerThread < 1) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        batchMode = 1;
+        return runStressTest(threadCount, opsPerThread);
+    }
+    
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        BenchConfig config = {1, BENCH_DEFAULT_ACCOUNTS, BENCH_DEFAULT_OPERATIONS, {30, 20, 30, 10, 10}};
+        for (int i = 2; i < argc; i++) {
+            int ok = (i + 1 < argc);
+            if (ok && strcmp(argv[i], "--seed") == 0) {
+                config.seed = strtoull(argv[++i], NULL, 10);
+            } else if (ok && strcmp(argv[i], "--accounts") == 0) {
+                config.accounts = atoi(argv[++i]);
+            } else if (ok && strcmp(argv[i], "--ops") == 0) {
+                config.operations = atoi(argv[++i]);
+            } else if (ok && strcmp(argv[i], "--mix") == 0) {
+                ok = parseBenchMix(argv[++i], config.mix);
+            } else if (ok && strcmp(argv[i], "--durability") == 0) {
+                ok = parseDurabilityMode(argv[++i], &durabilityMode);
+            } else {
+                ok = 0;
+            }
+            if (!ok) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        if (config.accounts < 1 || config.operations < 1) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        batchMode = 1;
+        return runBenchmark(&config);
+    }
+    
+    if (argc > 1 && strcmp(argv[1], "--login-bench") == 0) {
+        int logins = (argc > 2) ? atoi(argv[2]) : LOGIN_BENCH_DEFAULT_LOGINS;
+        if (logins < 1 || argc > 3) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        batchMode = 1;
+        return runLoginBenchmark(logins);
+    }
+    
+    const char *batchFile = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--batch") == 0) {
+            batchMode = 1;
+        } else if (strcmp(argv[i], "--durability") == 0 && i + 1 < argc) {
+            if (!parseDurabilityMode(argv[++i], &durabilityMode)) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (batchMode && batchFile == NULL && argv[i][0] != '-') {
+            batchFile = argv[i];
+        } else if (batchMode && batchFile == NULL && strcmp(argv[i], "-") == 0) {
+            batchFile = "-";
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    
+    if (!batchMode) {
+        initializeSystem();
+        mainMenu();
+        cleanup();
+        return 0;
+    }
+    
+    FILE *input = stdin;
+    if (batchFile != NULL && strcmp(batchFile, "-") != 0) {
+        input = fopen(batchFile, "r");
+        if (input == NULL) {
+            fprintf(stderr, "Error: Could not open %s\n", batchFile);
+            return 1;
+        }
+    }
+    
+    // Results go to stdout; status messages from startup and persistence
+    // are sent to stderr so the output stays machine-readable.
+    int resultFd = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    initializeSystem();
+    fflush(stdout);
+    dup2(resultFd, STDOUT_FILENO);
+    close(resultFd);
+    
+    int failures = runBatch(input);
+    fflush(stdout);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    cleanup();
+    
+    if (input != stdin) {
+        fclose(input);
+    }
+    return (failures > 0) ? 2 : 0;
 }